@@ -24,6 +24,10 @@ using namespace clang;
 
 int main(int argc, char **argv)
 {
+  /* Diagnostics of the command line.  Run_Passes installs its own.  */
+  DiagsClass diags;
+  DiagsClass::Scope diags_scope(&diags);
+
   ArgvParser args(argc, argv);
 
   auto func_extract_names = args.Get_Functions_To_Extract();
@@ -20,6 +20,7 @@
 #include <clang/Basic/Version.h>
 
 #include <filesystem>
+#include <algorithm>
 
 #ifndef CLANG_VERSION_MAJOR
 # error "Unable to find clang version"
@@ -75,11 +76,18 @@ ArgvParser::ArgvParser(int argc, char **argv)
     SymversPath(nullptr),
     DescOutputPath(nullptr),
     IncExpansionPolicy(nullptr),
-    OutputFunctionPrototypeHeader(nullptr)
+    ExpansionPolicyFile(nullptr),
+    OutputFunctionPrototypeHeader(nullptr),
+    Jobs(1),
+    MinimizeOutput(false),
+    DependencyFile(nullptr),
+    SkipUnchanged(false)
 {
   for (int i = 0; i < argc; i++) {
     if (!Handle_Clang_Extract_Arg(argv[i])) {
       ArgsToClang.push_back(argv[i]);
+    } else {
+      ClangExtractArgs.push_back(argv[i]);
     }
   }
 
@@ -122,6 +130,18 @@ void ArgvParser::Insert_Required_Parameters(void)
   }
 }
 
+std::vector<std::string> ArgvParser::Get_Normalized_Command_Line(void)
+{
+  /* The order of the arguments to clang matters, but clang-extract options
+     are independent of each other.  */
+  std::vector<std::string> args(ArgsToClang.begin(), ArgsToClang.end());
+  std::vector<std::string> ce_args = ClangExtractArgs;
+  std::sort(ce_args.begin(), ce_args.end());
+  args.insert(args.end(), ce_args.begin(), ce_args.end());
+
+  return args;
+}
+
 void ArgvParser::Print_Usage_Message(void)
 {
   llvm::outs() <<
@@ -145,6 +165,12 @@ void ArgvParser::Print_Usage_Message(void)
 "                           Keep all possible #include<file> directives, but using the\n"
 "                           specified include expansion <policy>.  Valid values are\n"
 "                           nothing, everything and kernel.\n"
+"  -DCE_EXPANSION_POLICY_FILE=<file>\n"
+"                           Keep #include directives, deciding which headers to\n"
+"                           expand by the rules in <file>.  Each line is a rule\n"
+"                           '<expand|keep> <prefix|glob|regex> <pattern>', and the\n"
+"                           first matching rule wins.  Headers matching no rule use\n"
+"                           the policy of -DCE_KEEP_INCLUDES=<policy>.\n"
 "  -DCE_EXPAND_INCLUDES=<args>\n"
 "                           Force expansion of the headers provided in <args>.\n"
 "  -DCE_RENAME_SYMBOLS      Allow renaming of extracted symbols.\n"
@@ -165,6 +191,19 @@ void ArgvParser::Print_Usage_Message(void)
 "  -DCE_LATE_EXTERNALIZE    Enable late externalization (declare externalized variables\n"
 "                           later than the original).  May reduce code output when\n"
 "                           -DCE_KEEP_INCLUDES is enabled\n"
+"  -DCE_JOBS=<n>            Use <n> threads to compute the closure of the functions\n"
+"                           being extracted.  Default is 1.\n"
+"  -DCE_MINIMIZE_OUTPUT     Output only a forward declaration of structs and unions\n"
+"                           which are only used through pointers, and do not output\n"
+"                           what their fields depend on.\n"
+"  -DCE_DEPFILE=<file>      Write a Makefile dependency file into <file>, listing\n"
+"                           the source files and analysis databases the output\n"
+"                           depends on.\n"
+"  -DCE_SKIP_UNCHANGED      Do nothing if neither the command line, clang-extract\n"
+"                           itself nor the files read when parsing the input changed\n"
+"                           since the last successful run.  Requires\n"
+"                           -DCE_OUTPUT_FILE, next to which a\n"
+"                           manifest of the inputs is kept.\n"
 "\n";
 
   llvm::outs() << "The following arguments are ignored by clang-extract:\n";
@@ -239,6 +278,11 @@ bool ArgvParser::Handle_Clang_Extract_Arg(const char *str)
     IncExpansionPolicy = Extract_Single_Arg_C(str);
     return true;
   }
+  if (prefix("-DCE_EXPANSION_POLICY_FILE=", str)) {
+    WithIncludes = true;
+    ExpansionPolicyFile = Extract_Single_Arg_C(str);
+    return true;
+  }
   if (prefix("-DCE_EXPAND_INCLUDES=", str)) {
     HeadersToExpand = Extract_Args(str);
 
@@ -279,6 +323,31 @@ bool ArgvParser::Handle_Clang_Extract_Arg(const char *str)
 
     return true;
   }
+  if (prefix("-DCE_JOBS=", str)) {
+    int jobs = atoi(Extract_Single_Arg_C(str));
+    if (jobs < 1) {
+      DiagsClass::Emit_Error("Invalid number of jobs: " + std::string(str));
+      exit(1);
+    }
+    Jobs = jobs;
+
+    return true;
+  }
+  if (!strcmp("-DCE_MINIMIZE_OUTPUT", str)) {
+    MinimizeOutput = true;
+
+    return true;
+  }
+  if (prefix("-DCE_DEPFILE=", str)) {
+    DependencyFile = Extract_Single_Arg_C(str);
+
+    return true;
+  }
+  if (!strcmp("-DCE_SKIP_UNCHANGED", str)) {
+    SkipUnchanged = true;
+
+    return true;
+  }
 
   if (!strcmp("--help", str)) {
     Print_Usage_Message();
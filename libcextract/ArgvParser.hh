@@ -134,6 +134,35 @@ class ArgvParser
     return AllowLateExternalization;
   }
 
+  inline unsigned Get_Jobs(void)
+  {
+    return Jobs;
+  }
+
+  inline const char *Get_Expansion_Policy_File(void)
+  {
+    return ExpansionPolicyFile;
+  }
+
+  inline bool Should_Minimize_Output(void)
+  {
+    return MinimizeOutput;
+  }
+
+  inline const char *Get_Dependency_File(void)
+  {
+    return DependencyFile;
+  }
+
+  inline bool Should_Skip_Unchanged(void)
+  {
+    return SkipUnchanged;
+  }
+
+  /** Get the command line in a form which does not depend on the order of
+      the clang-extract options.  */
+  std::vector<std::string> Get_Normalized_Command_Line(void);
+
   const char *Get_Input_File(void);
 
   /** Print help usage message.  */
@@ -145,6 +174,9 @@ class ArgvParser
 
   std::vector<const char *> ArgsToClang;
 
+  /* Arguments handled by clang-extract itself.  */
+  std::vector<std::string> ClangExtractArgs;
+
   std::vector<std::string> FunctionsToExtract;
   std::vector<std::string> SymbolsToExternalize;
   std::vector<std::string> HeadersToExpand;
@@ -171,5 +203,20 @@ class ArgvParser
 
   const char *IncExpansionPolicy;
 
+  /* File with user rules for include expansion.  */
+  const char *ExpansionPolicyFile;
+
   const char *OutputFunctionPrototypeHeader;
+
+  /* Number of threads used to compute the closure.  */
+  unsigned Jobs;
+
+  /* Output only forward declarations of records used through pointers.  */
+  bool MinimizeOutput;
+
+  /* Path to the Makefile dependency file to write.  */
+  const char *DependencyFile;
+
+  /* Skip the run if its inputs did not change.  */
+  bool SkipUnchanged;
 };
@@ -14,6 +14,10 @@
 /* Author: Giuliano Belinassi  */
 
 #include "Closure.hh"
+#include "Error.hh"
+
+#include <clang/Basic/CharInfo.h>
+#include <thread>
 
 /** Add a decl to the Dependencies set and all its previous declarations in the
     AST. A function can have multiple definitions but its body may only be
@@ -39,7 +43,8 @@ bool ClosureSet::Add_Decl_And_Prevs(Decl *decl)
 }
 
 void DeclClosureVisitor::Compute_Closure_Of_Symbols(const std::vector<std::string> &names,
-                                          std::unordered_set<std::string> *matched_names)
+                                          std::unordered_set<std::string> *matched_names,
+                                          unsigned jobs)
 {
   /* FIXME: clang has a mechanism (DeclContext::lookup) which is SUPPOSED TO
      return the list of all Decls that matches the lookup name.  However, this
@@ -52,6 +57,7 @@ void DeclClosureVisitor::Compute_Closure_Of_Symbols(const std::vector<std::strin
 
   std::unordered_set<std::string> setof_names(std::make_move_iterator(names.begin()),
                                               std::make_move_iterator(names.end()));
+  std::vector<Decl *> roots;
 
   for (auto it = AST->top_level_begin(); it != AST->top_level_end(); ++it) {
     NamedDecl *decl = dyn_cast<NamedDecl>(*it);
@@ -67,10 +73,151 @@ void DeclClosureVisitor::Compute_Closure_Of_Symbols(const std::vector<std::strin
       /* Mark that name as matched.  */
       if (matched_names)
         matched_names->insert(decl_name);
-      /* Find its dependencies.  */
-      TraverseDecl(decl);
+      roots.push_back(decl);
     }
   }
+
+  /* Traversing C++ code may trigger lazy allocations in the AST, such as the
+     common pointer of templates, so only C is computed in parallel.  So is
+     traversing an AST with an external source, e.g. the preamble, as getting
+     bodies, decls or redeclarations may deserialize them.  */
+  if (jobs > 1 && roots.size() > 1 && !AST->getLangOpts().CPlusPlus &&
+      AST->getASTContext().getExternalSource() == nullptr) {
+    Compute_Closure_In_Parallel(roots, jobs);
+    return;
+  }
+
+  for (Decl *decl : roots) {
+    /* Find its dependencies.  */
+    TraverseDecl(decl);
+  }
+}
+
+void DeclClosureVisitor::Compute_Closure_In_Parallel(const std::vector<Decl *> &roots,
+                                                     unsigned jobs)
+{
+  /* Without an external source, the traversal of C code only reads the AST.
+     What is not safe to share is the SourceManager, which caches its lookups,
+     and the symbol table, which is lazily built.  Those are guarded by a
+     lock, and any change to the AST is deferred until all workers are
+     done.  */
+  std::mutex shared_lock;
+
+  unsigned num_workers = std::min<size_t>(jobs, roots.size());
+  std::vector<std::unique_ptr<DeclClosureVisitor>> workers;
+  std::vector<std::thread> threads;
+
+  for (unsigned i = 0; i < num_workers; i++) {
+    std::unique_ptr<DeclClosureVisitor> worker(new DeclClosureVisitor(AST,
+                                                           MinimizeRecords));
+    worker->SharedLock = &shared_lock;
+    worker->TopLevelIndex = TopLevelIndex;
+    /* Do not analyze again what was already analyzed by us.  */
+    worker->AnalyzedDecls = AnalyzedDecls;
+    worker->ShallowRecords = ShallowRecords;
+    workers.push_back(std::move(worker));
+  }
+
+  /* Partition the roots across workers in a round-robin fashion.  Each worker
+     has its own set of analyzed decls, so a Decl reachable from two roots may
+     be analyzed twice, but the union of the results is the same as if
+     computed serially.  */
+  /* Workers report and print through the same context as we do.  */
+  PrettyPrintContext *print_ctx = &PrettyPrint::Ctx();
+  DiagsClass *diags = &DiagsClass::Get_Instance();
+
+  for (unsigned i = 0; i < num_workers; i++) {
+    DeclClosureVisitor *worker = workers[i].get();
+    threads.emplace_back([worker, &roots, i, num_workers, print_ctx, diags](void) {
+      PrettyPrintContext::Scope print_scope(print_ctx);
+      DiagsClass::Scope diags_scope(diags);
+      for (size_t j = i; j < roots.size(); j += num_workers) {
+        worker->TraverseDecl(roots[j]);
+      }
+    });
+  }
+
+  for (std::thread &thread : threads) {
+    thread.join();
+  }
+
+  /* Merge the results.  */
+  llvm::DenseSet<RecordDecl *> full_records;
+  for (std::unique_ptr<DeclClosureVisitor> &worker : workers) {
+    std::unordered_set<Decl *> &worker_set = worker->Closure.Get_Set();
+    Closure.Get_Set().insert(worker_set.begin(), worker_set.end());
+    AnalyzedDecls.insert(worker->AnalyzedDecls.begin(),
+                         worker->AnalyzedDecls.end());
+
+    /* A record may have been analyzed without its fields by one worker but
+       fully by another.  */
+    for (Decl *decl : worker->AnalyzedDecls) {
+      RecordDecl *record = dyn_cast<RecordDecl>(decl);
+      if (record && !worker->ShallowRecords.contains(record)) {
+        full_records.insert(record);
+      }
+    }
+    ShallowRecords.insert(worker->ShallowRecords.begin(),
+                          worker->ShallowRecords.end());
+  }
+
+  for (RecordDecl *record : full_records) {
+    ShallowRecords.erase(record);
+  }
+
+  /* Now that we are the only one touching the AST, apply the changes.  This
+     may also analyze the fields of records which turned out to be required.  */
+  for (std::unique_ptr<DeclClosureVisitor> &worker : workers) {
+    for (TagDecl *tag : worker->DeferredRequiredTags) {
+      Set_Complete_Definition_Required(tag);
+    }
+  }
+}
+
+/* ------ TypeSpellingTable methods ------ */
+
+DeclContextLookupResult TypeSpellingTable::Get_Decls_At(const SourceLocation &loc)
+{
+  auto it = Table.find(loc);
+  if (it != Table.end()) {
+    return it->second;
+  }
+
+  DeclContextLookupResult decls = Get_Decl_From_Symtab(AST, Get_Spelling_At(loc));
+  Table[loc] = decls;
+
+  return decls;
+}
+
+StringRef TypeSpellingTable::Get_Spelling_At(const SourceLocation &loc)
+{
+  SourceManager &sm = AST->getSourceManager();
+  const LangOptions &lo = AST->getLangOpts();
+
+  /* TypeLocs begin at the start of a token, so in the common case of a plain
+     identifier written in a file we can read it directly from the buffer
+     without invoking the Lexer.  */
+  if (loc.isFileID()) {
+    bool invalid = false;
+    const char *begin = sm.getCharacterData(loc, &invalid);
+    if (!invalid) {
+      const char *end = begin;
+      while (isAsciiIdentifierContinue(*end)) {
+        end++;
+      }
+
+      /* Escaped newlines, '$' and UCNs are better handled by the Lexer.  */
+      if (end != begin && *end != '\\' && *end != '$' && isASCII(*end)) {
+        return StringRef(begin, end - begin);
+      }
+    }
+  }
+
+  /* Get the range of the token which we expect is the type of it.  */
+  SourceLocation tok_begin = Lexer::GetBeginningOfToken(loc, sm, lo);
+  SourceLocation tok_end   = Lexer::getLocForEndOfToken(loc, 0, sm, lo);
+
+  return PrettyPrint::Get_Source_Text({tok_begin, tok_end});
 }
 
 /* ------ DeclClosureVisitor methods ------ */
@@ -90,6 +237,19 @@ bool DeclClosureVisitor::TraverseDecl(Decl *decl)
   return RecursiveASTVisitor::TraverseDecl(decl);
 }
 
+bool DeclClosureVisitor::TraverseRecordDecl(RecordDecl *decl)
+{
+  if (MinimizeRecords && !Is_Complete_Definition_Required(decl)) {
+    /* Only a forward declaration of this record will be output, hence we
+       don't need anything its fields reference.  Remember it in case a
+       complete definition turns out to be required later.  */
+    ShallowRecords.insert(decl);
+    return WalkUpFromRecordDecl(decl);
+  }
+
+  return RecursiveASTVisitor::TraverseRecordDecl(decl);
+}
+
 bool DeclClosureVisitor::VisitFunctionDecl(FunctionDecl *decl)
 {
   if (decl->getBuiltinID() != 0) {
@@ -121,7 +281,7 @@ bool DeclClosureVisitor::VisitFunctionDecl(FunctionDecl *decl)
   const clang::Type *ret_type = to_mark->getReturnType().getTypePtr();
   if (ret_type->isRecordType()) {
     if (TagDecl *tag = ret_type->getAsTagDecl()) {
-      tag->setCompleteDefinitionRequired(true);
+      TRY_TO(Set_Complete_Definition_Required(tag));
     }
   }
 
@@ -173,21 +333,19 @@ bool DeclClosureVisitor::VisitDeclaratorDecl(DeclaratorDecl *decl)
    *  decl that is in the symbol table with that name.
    */
 
-  SourceManager &sm = AST->getSourceManager();
-  const LangOptions &lo = AST->getLangOpts();
-
   const TypeSourceInfo *typeinfo = decl->getTypeSourceInfo();
   const TypeLoc &tl = typeinfo->getTypeLoc();
 
-  /* Get the range of the token which we expect is the type of it.  */
-  SourceLocation tok_begin = Lexer::GetBeginningOfToken(tl.getBeginLoc(), sm, lo);
-  SourceLocation tok_end   = Lexer::getLocForEndOfToken(tl.getBeginLoc(), 0, sm, lo);
-
-  StringRef text = PrettyPrint::Get_Source_Text({tok_begin, tok_end});
+  /* Lookup in the symbol table for any Decl matching the token which we
+     expect is the type of it.  */
+  SmallVector<NamedDecl *, 4> decls;
+  {
+    std::unique_lock<std::mutex> lock = Lock_Shared_State();
+    DeclContextLookupResult lookup = TypeSpellings.Get_Decls_At(tl.getBeginLoc());
+    decls.append(lookup.begin(), lookup.end());
+  }
 
-  /* Lookup in the symbol table for any Decl matching it.  */
-  DeclContextLookupResult decls = Get_Decl_From_Symtab(AST, text);
-  for (auto decl_it : decls) {
+  for (NamedDecl *decl_it : decls) {
     TRY_TO(TraverseDecl(decl_it));
   }
 
@@ -424,7 +582,7 @@ bool DeclClosureVisitor::VisitUnaryOperator(const UnaryOperator *expr)
    */
   const clang::Type *type = expr->getType().getTypePtr();
   if (TagDecl *tag = type->getAsTagDecl()) {
-    tag->setCompleteDefinitionRequired(true);
+    TRY_TO(Set_Complete_Definition_Required(tag));
   }
 
   return VISITOR_CONTINUE;
@@ -511,7 +669,7 @@ bool DeclClosureVisitor::ParentRecordDeclHelper(TagDecl *decl)
        then we need to set it to true, else the nested struct won't be
        output as of only a partial definition of the parent struct is
        output. */
-    parent->setCompleteDefinitionRequired(true);
+    TRY_TO(Set_Complete_Definition_Required(parent));
 
     /* Analyze parent struct.  */
     TRY_TO(TraverseDecl(parent));
@@ -522,9 +680,11 @@ bool DeclClosureVisitor::ParentRecordDeclHelper(TagDecl *decl)
 
 bool DeclClosureVisitor::AnalyzeDeclsWithSameBeginlocHelper(Decl *decl)
 {
-  SourceManager &SM = AST->getSourceManager();
-  VectorRef<Decl *> decls = Get_Toplev_Decls_With_Same_Beginloc(AST,
-                            SM.getExpansionLoc(decl->getBeginLoc()));
+  VectorRef<Decl *> decls(nullptr, 0u);
+  {
+    std::unique_lock<std::mutex> lock = Lock_Shared_State();
+    decls = TopLevelIndex->Get_Decls_With_Same_Beginloc(decl->getBeginLoc());
+  }
   unsigned n = decls.getSize();
   Decl **array = decls.getPointer();
   for (unsigned i = 0; i < n; i++) {
@@ -545,3 +705,66 @@ bool DeclClosureVisitor::AnalyzePreviousDecls(Decl *decl)
 
   return VISITOR_CONTINUE;
 }
+
+bool DeclClosureVisitor::Set_Complete_Definition_Required(TagDecl *tag)
+{
+  if (SharedLock) {
+    DeferredRequiredTags.push_back(tag);
+  } else {
+    tag->setCompleteDefinitionRequired(true);
+  }
+
+  /* If we skipped the fields of this record, then analyze them now.  */
+  RecordDecl *record = dyn_cast<RecordDecl>(tag);
+  if (record && ShallowRecords.erase(record)) {
+    TRY_TO(TraverseRecordBody(record));
+  }
+
+  return VISITOR_CONTINUE;
+}
+
+bool DeclClosureVisitor::Is_Complete_Definition_Required(RecordDecl *decl)
+{
+  /* A declaration without a body has nothing to be skipped.  */
+  if (!decl->isThisDeclarationADefinition()) {
+    return true;
+  }
+
+  /* Records without a name can't be forward declared.  */
+  if (decl->getIdentifier() == nullptr || decl->getTypedefNameForAnonDecl()) {
+    return true;
+  }
+
+  /* Nested records are output together with its parent, and records declared
+     together with a declarator, such as
+
+       typedef struct A { int a; } A_t;
+
+     are output as the user wrote, with the body.  */
+  if (isa<RecordDecl>(decl->getLexicalDeclContext()) ||
+      decl->isEmbeddedInDeclarator()) {
+    return true;
+  }
+
+  if (decl->isCompleteDefinitionRequired()) {
+    return true;
+  }
+
+  /* When running in parallel, a complete definition may have been required
+     by this worker without touching the AST yet.  */
+  return std::find(DeferredRequiredTags.begin(), DeferredRequiredTags.end(),
+                   decl) != DeferredRequiredTags.end();
+}
+
+bool DeclClosureVisitor::TraverseRecordBody(RecordDecl *decl)
+{
+  for (Decl *child : decl->decls()) {
+    TRY_TO(TraverseDecl(child));
+  }
+
+  for (Attr *attr : decl->attrs()) {
+    TRY_TO(TraverseAttr(attr));
+  }
+
+  return VISITOR_CONTINUE;
+}
@@ -19,7 +19,11 @@
 #include <clang/Frontend/ASTUnit.h>
 #include <clang/Sema/IdentifierResolver.h>
 #include <clang/AST/RecursiveASTVisitor.h>
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/ADT/DenseSet.h>
 #include <unordered_set>
+#include <memory>
+#include <mutex>
 
 #include "LLVMMisc.hh"
 #include "PrettyPrint.hh"
@@ -67,6 +71,37 @@ class ClosureSet
   std::unordered_set<Decl*> Dependencies;
 };
 
+/** Side table mapping the begin location of a TypeLoc to the Decls whose name
+    is spelled there.
+
+    Clang sometimes loses the reference to a typedef when it is followed by
+    attributes (see DeclClosureVisitor::VisitDeclaratorDecl), so we recover it
+    by looking at what is written in the source code.  Re-lexing the token for
+    every DeclaratorDecl is expensive on large structs, hence each location is
+    resolved once and its result is kept here for the lifetime of the AST.  */
+class TypeSpellingTable
+{
+  public:
+  TypeSpellingTable(ASTUnit *ast)
+    : AST(ast)
+  {
+  }
+
+  /** Get the Decls whose name is spelled at the TypeLoc begin location loc.  */
+  DeclContextLookupResult Get_Decls_At(const SourceLocation &loc);
+
+  private:
+  /** Get the identifier spelled at loc, or the token in case it is not an
+      identifier.  */
+  StringRef Get_Spelling_At(const SourceLocation &loc);
+
+  /** The ASTUnit object.  */
+  ASTUnit *AST;
+
+  /** The table itself, indexed by the TypeLoc begin location.  */
+  llvm::DenseMap<SourceLocation, DeclContextLookupResult> Table;
+};
+
 
 /// AST visitor for computing the closure of given symbol. From clang:
 ///
@@ -138,9 +173,13 @@ class ClosureSet
 class DeclClosureVisitor : public RecursiveASTVisitor<DeclClosureVisitor>
 {
   public:
-  DeclClosureVisitor(ASTUnit *ast)
+  DeclClosureVisitor(ASTUnit *ast, bool minimize_records = false)
     : RecursiveASTVisitor(),
-      AST(ast)
+      AST(ast),
+      TypeSpellings(ast),
+      TopLevelIndex(new TopLevelDeclIndex(ast)),
+      SharedLock(nullptr),
+      MinimizeRecords(minimize_records)
   {
   }
 
@@ -174,6 +213,10 @@ class DeclClosureVisitor : public RecursiveASTVisitor<DeclClosureVisitor>
      far it seems we only need this function for now.  */
   bool TraverseDecl(Decl *decl);
 
+  /* When minimizing records, do not traverse the fields of records in which
+     only a forward declaration will be output.  */
+  bool TraverseRecordDecl(RecordDecl *decl);
+
   /* -------- C Declarations ----------------- */
 
   bool VisitFunctionDecl(FunctionDecl *decl);
@@ -246,6 +289,19 @@ class DeclClosureVisitor : public RecursiveASTVisitor<DeclClosureVisitor>
 
   bool AnalyzePreviousDecls(Decl *decl);
 
+  /** Mark that a complete definition of tag is required for output.  When
+      running in parallel this change to the AST is deferred to after all
+      workers are finished.  If the body of tag was skipped because of
+      MinimizeRecords, then it is analyzed now.  */
+  bool Set_Complete_Definition_Required(TagDecl *tag);
+
+  /** Check if a complete definition of record will be output, thus its
+      fields are needed.  */
+  bool Is_Complete_Definition_Required(RecordDecl *decl);
+
+  /** Analyze the fields and attributes of a record.  */
+  bool TraverseRecordBody(RecordDecl *decl);
+
   ClosureSet &Get_Closure(void)
   {
     return Closure;
@@ -256,10 +312,35 @@ class DeclClosureVisitor : public RecursiveASTVisitor<DeclClosureVisitor>
     return Closure;
   }
 
+  /** Index of toplevel decls by their location in the AST.  */
+  TopLevelDeclIndex &Get_Toplevel_Index(void)
+  {
+    return *TopLevelIndex;
+  }
+
+  /** Compute the closure of the symbols in names.  If jobs is larger than 1
+      then the symbols are partitioned across jobs threads.  The result is
+      the same as running it serially.  */
   void Compute_Closure_Of_Symbols(const std::vector<std::string> &names,
-                                 std::unordered_set<std::string> *matched_names = nullptr);
+                                 std::unordered_set<std::string> *matched_names = nullptr,
+                                 unsigned jobs = 1);
 
   private:
+  /** Compute the closure of roots using jobs worker threads, each one with
+      its own DeclClosureVisitor, and then merge their results into this.  */
+  void Compute_Closure_In_Parallel(const std::vector<Decl *> &roots,
+                                   unsigned jobs);
+
+  /** Lock the state shared between workers, such as the SourceManager and
+      the symbol table.  Does nothing when running serially.  */
+  inline std::unique_lock<std::mutex> Lock_Shared_State(void)
+  {
+    if (SharedLock) {
+      return std::unique_lock<std::mutex>(*SharedLock);
+    }
+    return std::unique_lock<std::mutex>();
+  }
+
 
   /** The ASTUnit object.  */
   ASTUnit *AST;
@@ -273,4 +354,25 @@ class DeclClosureVisitor : public RecursiveASTVisitor<DeclClosureVisitor>
 
   /** The set of all analyzed Decls.  */
   std::unordered_set<Decl *> AnalyzedDecls;
+
+  /** Decls spelled at the begin of each TypeLoc, used to recover typedefs
+      lost by clang.  */
+  TypeSpellingTable TypeSpellings;
+
+  /** Index of toplevel decls, shared with the parallel workers.  */
+  std::shared_ptr<TopLevelDeclIndex> TopLevelIndex;
+
+  /** Lock shared by all workers when computing the closure in parallel.  */
+  std::mutex *SharedLock;
+
+  /** TagDecls which requires a complete definition, but whose AST change was
+      deferred because we are running in parallel.  */
+  std::vector<TagDecl *> DeferredRequiredTags;
+
+  /** Emit only forward declarations of records which are only used through
+      pointers, and do not analyze what their definitions need.  */
+  bool MinimizeRecords;
+
+  /** Records analyzed without their fields because of MinimizeRecords.  */
+  llvm::DenseSet<RecordDecl *> ShallowRecords;
 };
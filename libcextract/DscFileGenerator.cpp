@@ -97,6 +97,16 @@ void DscFileGenerator::Local_Symbols(void)
   TranslationUnitDecl *tu = AST->getASTContext().getTranslationUnitDecl();
   IdentifierTable &idtbl = AST->getPreprocessor().getIdentifierTable();
 
+  /* Resolve the modules of all symbols at once.  */
+  std::vector<std::string> old_names;
+  for (const ExternalizerLogEntry &entry : ExternalizerLog) {
+    if (entry.Type == ExternalizationType::STRONG) {
+      old_names.push_back(entry.OldName);
+    }
+  }
+  std::vector<const SymbolResolution *> resolved = IA.Resolve_Symbols(old_names);
+
+  unsigned i = 0;
   for (const ExternalizerLogEntry &entry : ExternalizerLog) {
     if (entry.Type == ExternalizationType::STRONG) {
       DeclContext::lookup_result decls = tu->lookup(
@@ -105,7 +115,7 @@ void DscFileGenerator::Local_Symbols(void)
         throw std::runtime_error("Unable to find symbol " + entry.NewName + " in the AST");
       }
       Out << "\n#" << entry.OldName << ":" << entry.NewName;
-      std::string mod = IA.Get_Symbol_Module(entry.OldName);
+      const std::string &mod = resolved[i++]->Module;
       if (!mod.empty())
         Out << ":" << mod;
     }
@@ -23,7 +23,7 @@ DiagnosticOptionsWithColor::DiagnosticOptionsWithColor(void)
   DOpts->ShowColors = check_color_available();
 }
 
-DiagsClass DiagsClass::sDiag;
+thread_local DiagsClass *DiagsClass::Current = nullptr;
 
 DiagsClass::DiagsClass(void)
   : LangOpts(),
@@ -49,7 +49,7 @@ void DiagsClass::EmitMessage(const StringRef message, DiagnosticsEngine::Level l
 /* Print error without giving a piece of source code that caused the error.  */
 void DiagsClass::EmitMessage(const StringRef message, DiagnosticsEngine::Level level)
 {
-  bool colored = Is_Colored();
+  bool colored = DOpts.Is_Colored();
   const std::string ce_message = Append_CE(message);
   TextDiagnostic::printDiagnosticLevel(llvm::outs(), level, colored);
   TextDiagnostic::printDiagnosticMessage(llvm::outs(), false, ce_message, 0, 0, colored);
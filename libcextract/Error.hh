@@ -18,6 +18,8 @@
 #include <clang/Frontend/TextDiagnostic.h>
 #include <clang/Basic/LangOptions.h>
 
+#include <cassert>
+
 using namespace clang;
 
 /* Creates a special DiagnosticOptions with forced ShowColors.  */
@@ -62,15 +64,44 @@ class DiagsClass
   TextDiagnostic DiagsEngine;
 
   protected:
-  static DiagsClass sDiag;
+  /* Instance in use by the calling thread, or nullptr if none.  */
+  static thread_local DiagsClass *Current;
 
   public:
   DiagsClass(DiagsClass &o) = delete;
   void operator=(const DiagsClass &o) = delete;
 
+  /** Use diags as the instance of the calling thread for the lifetime of this
+      object.  */
+  class Scope
+  {
+    public:
+    Scope(DiagsClass *diags)
+      : Previous(Current)
+    {
+      Current = diags;
+    }
+
+    ~Scope(void)
+    {
+      Current = Previous;
+    }
+
+    Scope(const Scope &) = delete;
+    void operator=(const Scope &) = delete;
+
+    private:
+    DiagsClass *Previous;
+  };
+
+  /** Get the instance in use by the calling thread.  One must be installed
+      through a Scope: threads working on an extraction install the one of
+      the run, and main installs one at startup.  */
   static inline DiagsClass &Get_Instance(void)
   {
-    return sDiag;
+    DiagsClass *diags = Current;
+    assert(diags && "No DiagsClass installed in this thread");
+    return *diags;
   }
 
   static inline bool Is_Colored(void)
@@ -82,13 +113,13 @@ class DiagsClass
                                   DiagnosticsEngine::Level level,
                                   const SourceRange &range)
   {
-    sDiag.EmitMessage(message, level, range);
+    Get_Instance().EmitMessage(message, level, range);
   }
 
   static inline void Emit_Message(const StringRef message,
                                   DiagnosticsEngine::Level level)
   {
-    sDiag.EmitMessage(message, level);
+    Get_Instance().EmitMessage(message, level);
   }
 
   static inline void Emit_Error(const StringRef message, const SourceRange &range)
@@ -38,15 +38,26 @@
 #include "ExpansionPolicy.hh"
 #include "NonLLVMMisc.hh"
 
+#include <clang/Basic/FileEntry.h>
 #include <llvm/Support/raw_ostream.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/LineIterator.h>
+
+#include <algorithm>
+#include <stdexcept>
+
+bool IncludeExpansionPolicy::Must_Expand_File(const clang::FileEntry &file)
+{
+  return Must_Expand(file.tryGetRealPathName(), file.getName());
+}
 
 bool KernelExpansionPolicy::Must_Expand(const StringRef &absolute_path,
                                         const StringRef &relative_path)
 {
-  std::vector<std::string> include_paths = { "/include/", "/arch/" };
+  static const StringRef include_paths[] = { "/include/", "/arch/" };
 
-  for (auto &path : include_paths) {
-    if (absolute_path.find(path) != std::string::npos)
+  for (const StringRef &path : include_paths) {
+    if (absolute_path.contains(path))
       return false;
   }
 
@@ -100,6 +111,18 @@ std::unique_ptr<IncludeExpansionPolicy> IncludeExpansionPolicy::Get_Expansion_Po
   }
 }
 
+std::shared_ptr<IncludeExpansionPolicy> IncludeExpansionPolicy::Get_Expansion_Policy_Shared(
+                                                        IncludeExpansionPolicy::Policy p,
+                                                        const char *rules_file)
+{
+  if (rules_file == nullptr) {
+    return Get_Expansion_Policy_Unique(p);
+  }
+
+  return std::make_shared<RuleBasedExpansionPolicy>(rules_file,
+                                            Get_Expansion_Policy_Unique(p));
+}
+
 IncludeExpansionPolicy::Policy IncludeExpansionPolicy::Get_From_String(const char *str)
 {
   if (str == nullptr) {
@@ -123,3 +146,195 @@ IncludeExpansionPolicy::Policy IncludeExpansionPolicy::Get_From_String(const cha
 
   return IncludeExpansionPolicy::NOTHING;
 }
+
+/* ----- RuleBasedExpansionPolicy ------ */
+
+RuleBasedExpansionPolicy::RuleBasedExpansionPolicy(const char *rules_file,
+                              std::unique_ptr<IncludeExpansionPolicy> fallback)
+  : Fallback(std::move(fallback))
+{
+  /* Root of the trie.  */
+  Trie.push_back({ {}, NO_RULE });
+
+  Load_Rules(rules_file);
+}
+
+void RuleBasedExpansionPolicy::Load_Rules(const char *rules_file)
+{
+  auto buffer = llvm::MemoryBuffer::getFile(rules_file);
+  if (!buffer) {
+    throw std::runtime_error("unable to open expansion policy file " +
+                             std::string(rules_file) + ": " +
+                             buffer.getError().message());
+  }
+
+  for (llvm::line_iterator it(**buffer, /*SkipBlanks=*/true, '#');
+       !it.is_at_eof(); ++it) {
+    StringRef line = it->trim();
+    if (line.empty()) {
+      continue;
+    }
+
+    std::string where = std::string(rules_file) + ":" +
+                        std::to_string(it.line_number()) + ": ";
+
+    /* Split the line in action, kind and pattern.  The pattern is the rest
+       of the line, which may contain spaces.  */
+    auto [action, rest] = line.split(' ');
+    rest = rest.ltrim();
+    auto [kind, pattern] = rest.split(' ');
+    pattern = pattern.trim();
+
+    if (pattern.empty()) {
+      throw std::runtime_error(where + "expected '<expand|keep> "
+                               "<prefix|glob|regex> <pattern>'");
+    }
+
+    Rule rule;
+    if (action == "expand") {
+      rule.Expand = true;
+    } else if (action == "keep") {
+      rule.Expand = false;
+    } else {
+      throw std::runtime_error(where + "unknown action '" + action.str() +
+                               "', expected expand or keep");
+    }
+
+    unsigned rule_index = Rules.size();
+    if (kind == "prefix") {
+      rule.Kind = PREFIX;
+      rule.Index = 0;
+      Insert_Prefix(pattern, rule_index);
+    } else if (kind == "glob") {
+      auto glob = llvm::GlobPattern::create(pattern);
+      if (!glob) {
+        throw std::runtime_error(where + "invalid glob: " +
+                                 llvm::toString(glob.takeError()));
+      }
+      rule.Kind = GLOB;
+      rule.Index = Globs.size();
+      Globs.push_back(std::move(*glob));
+    } else if (kind == "regex") {
+      std::unique_ptr<llvm::Regex> regex(new llvm::Regex(pattern));
+      std::string error;
+      if (!regex->isValid(error)) {
+        throw std::runtime_error(where + "invalid regex: " + error);
+      }
+      rule.Kind = REGEX;
+      rule.Index = Regexes.size();
+      Regexes.push_back(std::move(regex));
+    } else {
+      throw std::runtime_error(where + "unknown rule kind '" + kind.str() +
+                               "', expected prefix, glob or regex");
+    }
+
+    Rules.push_back(rule);
+  }
+}
+
+void RuleBasedExpansionPolicy::Insert_Prefix(StringRef prefix, unsigned rule)
+{
+  unsigned node = 0;
+
+  for (char c : prefix) {
+    unsigned next = NO_RULE;
+    for (auto &edge : Trie[node].Edges) {
+      if (edge.first == c) {
+        next = edge.second;
+        break;
+      }
+    }
+
+    if (next == NO_RULE) {
+      next = Trie.size();
+      /* Careful: this may invalidate references to Trie elements.  */
+      Trie.push_back({ {}, NO_RULE });
+      Trie[node].Edges.push_back({ c, next });
+    }
+    node = next;
+  }
+
+  /* Only the first rule with a given prefix can ever match.  */
+  Trie[node].FirstRule = std::min(Trie[node].FirstRule, rule);
+}
+
+unsigned RuleBasedExpansionPolicy::Match_Prefix(StringRef path)
+{
+  unsigned node = 0;
+  unsigned first = Trie[0].FirstRule;
+
+  for (char c : path) {
+    unsigned next = NO_RULE;
+    for (auto &edge : Trie[node].Edges) {
+      if (edge.first == c) {
+        next = edge.second;
+        break;
+      }
+    }
+
+    if (next == NO_RULE) {
+      break;
+    }
+    node = next;
+    first = std::min(first, Trie[node].FirstRule);
+  }
+
+  return first;
+}
+
+unsigned RuleBasedExpansionPolicy::Match(StringRef absolute_path,
+                                         StringRef relative_path)
+{
+  unsigned first = std::min(Match_Prefix(absolute_path),
+                            Match_Prefix(relative_path));
+
+  /* Glob and regex rules are only worth checking if they come before the
+     prefix rule which matched.  */
+  for (unsigned i = 0; i < first && i < Rules.size(); i++) {
+    const Rule &rule = Rules[i];
+    switch (rule.Kind) {
+      case GLOB:
+        if (Globs[rule.Index].match(absolute_path) ||
+            Globs[rule.Index].match(relative_path)) {
+          return i;
+        }
+        break;
+
+      case REGEX:
+        if (Regexes[rule.Index]->match(absolute_path) ||
+            Regexes[rule.Index]->match(relative_path)) {
+          return i;
+        }
+        break;
+
+      case PREFIX:
+        /* Already handled by the trie.  */
+        break;
+    }
+  }
+
+  return first;
+}
+
+bool RuleBasedExpansionPolicy::Must_Expand(const StringRef &absolute_path,
+                                           const StringRef &relative_path)
+{
+  unsigned rule = Match(absolute_path, relative_path);
+  if (rule != NO_RULE) {
+    return Rules[rule].Expand;
+  }
+
+  return Fallback->Must_Expand(absolute_path, relative_path);
+}
+
+bool RuleBasedExpansionPolicy::Must_Expand_File(const clang::FileEntry &file)
+{
+  auto it = Decisions.find(file.getUniqueID());
+  if (it != Decisions.end()) {
+    return it->second;
+  }
+
+  bool expand = Must_Expand(file.tryGetRealPathName(), file.getName());
+  Decisions[file.getUniqueID()] = expand;
+  return expand;
+}
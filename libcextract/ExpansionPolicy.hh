@@ -16,15 +16,29 @@
 #pragma once
 
 #include <llvm/ADT/StringRef.h>
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/Support/FileSystem/UniqueID.h>
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/Support/GlobPattern.h>
+#include <llvm/Support/Regex.h>
 #include <memory>
+#include <vector>
 
 using namespace llvm;
 
+namespace clang {
+  class FileEntry;
+}
+
 class IncludeExpansionPolicy
 {
   public:
   virtual bool Must_Expand(const StringRef &absolute_path, const StringRef &relative_path) = 0;
 
+  /** Same as Must_Expand, but for a file the FileManager knows.  Policies
+      which are expensive to evaluate memoize the decision per file.  */
+  virtual bool Must_Expand_File(const clang::FileEntry &file);
+
   virtual ~IncludeExpansionPolicy() = default;
 
   enum Policy {
@@ -38,6 +52,13 @@ class IncludeExpansionPolicy
   static std::unique_ptr<IncludeExpansionPolicy>
                 Get_Expansion_Policy_Unique(Policy policy);
 
+  /** Get the policy to be shared by every IncludeTree.  If rules_file is not
+      null, then the rules in it are loaded and policy is only used for
+      headers which match no rule.  */
+  static std::shared_ptr<IncludeExpansionPolicy>
+                Get_Expansion_Policy_Shared(Policy policy,
+                                            const char *rules_file = nullptr);
+
   static Policy Get_From_String(const char *string);
   inline static Policy Get_Overriding(const char *string, bool is_kernel)
   {
@@ -80,3 +101,78 @@ class KernelExpansionPolicy : public IncludeExpansionPolicy
   public:
   virtual bool Must_Expand(const StringRef &absolute_path, const StringRef &relative_path);
 };
+
+/** @brief Expansion policy loaded from a file of user rules.
+ *
+ * Each non-empty line of the file which does not start with '#' is a rule
+ * in the format:
+ *
+ *   <expand|keep> <prefix|glob|regex> <pattern>
+ *
+ * A rule matches a header if its pattern matches the absolute or the relative
+ * path of the header.  The first rule in the file that matches decides if the
+ * header is expanded or kept as an #include.  Headers which match no rule are
+ * decided by the fallback policy.
+ *
+ * Prefix rules are compiled into a trie so that all of them are checked in a
+ * single walk through the path, and decisions are memoized by file since the
+ * same header is queried once per #include of it.
+ */
+class RuleBasedExpansionPolicy : public IncludeExpansionPolicy
+{
+  public:
+  RuleBasedExpansionPolicy(const char *rules_file,
+                           std::unique_ptr<IncludeExpansionPolicy> fallback);
+
+  virtual bool Must_Expand(const StringRef &absolute_path, const StringRef &relative_path);
+
+  virtual bool Must_Expand_File(const clang::FileEntry &file);
+
+  private:
+  enum RuleKind {
+    PREFIX,
+    GLOB,
+    REGEX,
+  };
+
+  struct Rule {
+    RuleKind Kind;
+    bool Expand;
+    /* Index of the pattern in Globs or Regexes.  Unused for prefixes.  */
+    unsigned Index;
+  };
+
+  /* Node of the trie of prefix rules.  */
+  struct TrieNode {
+    llvm::SmallVector<std::pair<char, unsigned>, 4> Edges;
+    /* First rule which has the prefix ending in this node.  */
+    unsigned FirstRule;
+  };
+
+  /** Parse the rules file.  Throws an std::runtime_error on failure.  */
+  void Load_Rules(const char *rules_file);
+
+  /** Insert a prefix rule into the trie.  */
+  void Insert_Prefix(StringRef prefix, unsigned rule);
+
+  /** Get the first prefix rule matching path, or NO_RULE.  */
+  unsigned Match_Prefix(StringRef path);
+
+  /** Get the first rule matching any of the paths, or NO_RULE.  */
+  unsigned Match(StringRef absolute_path, StringRef relative_path);
+
+  static constexpr unsigned NO_RULE = ~0U;
+
+  std::vector<Rule> Rules;
+  std::vector<TrieNode> Trie;
+  std::vector<llvm::GlobPattern> Globs;
+  std::vector<std::unique_ptr<llvm::Regex>> Regexes;
+
+  /* Policy used when no rule matches.  */
+  std::unique_ptr<IncludeExpansionPolicy> Fallback;
+
+  /* Memoized decisions, keyed by the UniqueID of the FileEntry.  The policy
+     outlives the FileManager of each AST, so their FileEntry pointers may be
+     reused for other files.  */
+  llvm::DenseMap<llvm::sys::fs::UniqueID, bool> Decisions;
+};
@@ -20,13 +20,21 @@
 #include "PrettyPrint.hh"
 #include "Error.hh"
 #include "LLVMMisc.hh"
+#include "IntervalTree.hh"
+
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/ADT/DenseSet.h>
+
+/* IntervalTree.  */
+using namespace Intervals;
 
 /** FunctionDependencyFinder class methods implementation.  */
 FunctionDependencyFinder::FunctionDependencyFinder(PassManager::Context *ctx)
     : AST(ctx->AST.get()),
-      IT(AST, ctx->IncExpansionPolicy, ctx->HeadersToExpand),
+      IT(AST, ctx->ExpansionPolicy, ctx->HeadersToExpand),
       KeepIncludes(ctx->KeepIncludes),
-      Visitor(AST)
+      Jobs(ctx->Jobs),
+      Visitor(AST, ctx->MinimizeOutput)
 {
 }
 
@@ -34,7 +42,7 @@ bool FunctionDependencyFinder::Find_Functions_Required(
     std::vector<std::string> const &funcnames)
 {
   std::unordered_set<std::string> matched_names;
-  Visitor.Compute_Closure_Of_Symbols(funcnames, &matched_names);
+  Visitor.Compute_Closure_Of_Symbols(funcnames, &matched_names, Jobs);
 
   /* Find which names did not match any declaration name.  */
   for (const std::string &funcname : funcnames) {
@@ -53,10 +61,91 @@ void FunctionDependencyFinder::Print(void)
   RecursivePrint(AST, closure.Get_Set(), IT, KeepIncludes).Print();
 }
 
+/** Location of Decls in the form of offsets into the file they were expanded,
+    so checking if a Decl contains another is done by comparing integers
+    rather than decoding lines and columns.  Each Decl is decomposed once, and
+    its source text is only extracted once when needed.  */
+class DeclOffsetsMap
+{
+  public:
+  DeclOffsetsMap(SourceManager &sm)
+    : SM(sm)
+  {
+  }
+
+  struct DeclOffsets
+  {
+    /* Offsets of the begin and end of the Decl, with the FileID in the upper
+       32 bits so Decls in distinct files never contain each other.  */
+    uint64_t Begin;
+    uint64_t End;
+
+    /* Is the range of the Decl valid and inside a single file?  */
+    bool Valid;
+
+    /* Is the source text of the Decl available?  -1 if not computed yet.  */
+    int HasText;
+  };
+
+  DeclOffsets &Get(Decl *decl)
+  {
+    auto it = Map.find(decl);
+    if (it != Map.end()) {
+      return it->second;
+    }
+
+    SourceRange range = decl->getSourceRange();
+    DeclOffsets offsets = { 0, 0, false, -1 };
+
+    if (range.isValid()) {
+      std::pair<FileID, unsigned> begin = SM.getDecomposedExpansionLoc(range.getBegin());
+      std::pair<FileID, unsigned> end   = SM.getDecomposedExpansionLoc(range.getEnd());
+
+      if (begin.first == end.first) {
+        uint64_t file = (uint64_t)begin.first.getHashValue() << 32;
+        offsets.Begin = file | begin.second;
+        offsets.End   = file | end.second;
+        offsets.Valid = true;
+      }
+    }
+
+    return Map[decl] = offsets;
+  }
+
+  /** Check if the source text of decl is available, which means it will be
+      printed as written by the user and not as an AST dump.  */
+  bool Has_Source_Text(Decl *decl)
+  {
+    DeclOffsets &offsets = Get(decl);
+    if (offsets.HasText < 0) {
+      offsets.HasText = PrettyPrint::Get_Source_Text(decl->getSourceRange()) != "";
+    }
+
+    return offsets.HasText;
+  }
+
+  /** Check if Decl a contains Decl b.  */
+  bool Contains(Decl *a, Decl *b)
+  {
+    /* Copy, as Get may grow the map.  */
+    DeclOffsets a_offsets = Get(a);
+    DeclOffsets b_offsets = Get(b);
+
+    return a_offsets.Valid && b_offsets.Valid &&
+           a_offsets.Begin <= b_offsets.Begin && b_offsets.End <= a_offsets.End;
+  }
+
+  private:
+  SourceManager &SM;
+
+  llvm::DenseMap<Decl *, DeclOffsets> Map;
+};
+
 void FunctionDependencyFinder::Remove_Redundant_Decls(void)
 {
   ClosureSet &closure = Visitor.Get_Closure();
   std::unordered_set<Decl *> &closure_set = closure.Get_Set();
+  DeclOffsetsMap offsets_map(AST->getSourceManager());
 
   for (auto it = closure_set.begin(); it != closure_set.end(); ++it) {
     /* Handle the case where a enum or struct is declared as:
@@ -90,9 +179,7 @@ void FunctionDependencyFinder::Remove_Redundant_Decls(void)
 
         which is a redeclaration of enum Hand. Hence we have to remove the
         first `enum Hand` from the closure.  See typedef-7.c testcase.  */
-    if (TypedefDecl *decl = dynamic_cast<TypedefDecl *>(*it)) {
-      SourceRange range = decl->getSourceRange();
-
+    if (TypedefDecl *decl = dyn_cast<TypedefDecl>(*it)) {
       const clang::Type *type = decl->getTypeForDecl();
       if (type) {
         /* We must be careful with pointers, the user can define things like:
@@ -112,17 +199,12 @@ void FunctionDependencyFinder::Remove_Redundant_Decls(void)
         TagDecl *typedecl = type->getAsTagDecl();
 
         if (typedecl && closure.Is_Decl_Marked(typedecl)) {
-          SourceRange type_range = typedecl->getSourceRange();
-
           /* Check if the strings regarding an decl empty. In that case we
              can not delete the decl from list.  */
-          if (PrettyPrint::Get_Source_Text(range) != "" &&
-              PrettyPrint::Get_Source_Text(type_range) != "") {
-
-            /* Using .fullyContains() fails in some declarations.  */
-            if (PrettyPrint::Contains_From_LineCol(range, type_range)) {
-              closure.Remove_Decl(typedecl);
-            }
+          if (offsets_map.Contains(decl, typedecl) &&
+              offsets_map.Has_Source_Text(decl) &&
+              offsets_map.Has_Source_Text(typedecl)) {
+            closure.Remove_Decl(typedecl);
           }
         }
       }
@@ -150,9 +232,7 @@ void FunctionDependencyFinder::Remove_Redundant_Decls(void)
         this will remove the first enum declaration because the location
         tracking will correctly include the enum system_states.  */
 
-    else if (DeclaratorDecl *decl = dynamic_cast<DeclaratorDecl *>(*it)) {
-      SourceRange range = decl->getSourceRange();
-
+    else if (DeclaratorDecl *decl = dyn_cast<DeclaratorDecl>(*it)) {
       const clang::Type *type = ClangCompat::getTypePtr(decl->getType());
       /* There are some cases where a variable is declared as follows:
 
@@ -190,79 +270,112 @@ void FunctionDependencyFinder::Remove_Redundant_Decls(void)
 
       TagDecl *typedecl = type ? type->getAsTagDecl() : nullptr;
       if (typedecl && closure.Is_Decl_Marked(typedecl)) {
-        SourceRange type_range = typedecl->getSourceRange();
-
-        /* Using .fullyContains() fails in some declarations.  */
-        if (PrettyPrint::Contains_From_LineCol(range, type_range)) {
+        if (offsets_map.Contains(decl, typedecl)) {
           closure.Remove_Decl(typedecl);
         }
       }
     }
   }
 
-  // FIXME: use interval tree
+  /* Collect the marked toplevel decls in the order they appear in the
+     translation unit.  */
+  std::vector<Decl *> marked;
   ASTUnit::top_level_iterator it;
-  Decl *prev = nullptr;
   for (it = AST->top_level_begin(); it != AST->top_level_end(); ++it) {
     Decl *decl = *it;
     if (isa<TypedefDecl>(decl) || isa<DeclaratorDecl>(decl) || isa<TagDecl>(decl)) {
-      if (!closure.Is_Decl_Marked(decl))
-        continue;
-
-      // Set prev and exit, since we don't have anything to compare agains't
-      if (!prev) {
-        prev = decl;
-        continue;
+      if (closure.Is_Decl_Marked(decl) && offsets_map.Get(decl).Valid) {
+        marked.push_back(decl);
       }
+    }
+  }
 
-      /*
-       * Check if there wasn't any symbol that is being defined in the same
-       * interval and remove it. Otherwise we might clash the types.
-       *
-       * One example of how this can happen is then we have something like
-       *
-       * typedef struct {
-       * ...
-       * } x, y;
-       *
-       * In the process of creating the closure we might reach the following
-       * situation:
-       *
-       * typdef struct {
-       * ...
-       * } x;
-       *
-       * typedef struct {
-       *
-       * } x, y;
-       *
-       * Which then breaks the one-definition-rule. In such cases, remove the
-       * previous declaration in the same code range, since the later will
-       * contain both definitions either way.
-       *
-       * Also be careful to make sure those declarations will be print as
-       * based on the source text and not in AST dump.  In the later case
-       * we don't want to remove it.
-       */
-      if (PrettyPrint::Get_Source_Text(decl->getSourceRange()) != "" &&
-          PrettyPrint::Get_Source_Text(prev->getSourceRange()) != "" &&
-          PrettyPrint::Contains_From_LineCol(decl->getSourceRange(),
-                                              prev->getSourceRange())) {
-        /*
-         * If the prev and the current decl have the same start LoC, but
-         * different ending, remove the prev from the closure and set the
-         * new prev.
-         */
-        closure.Remove_Decl(prev);
-      }
+  /* Interval tree of the marked decls, indexed by their position in the
+     translation unit.  */
+  IntervalTree<uint64_t, size_t> interval_tree;
+  for (size_t i = 0; i < marked.size(); i++) {
+    const DeclOffsetsMap::DeclOffsets &offsets = offsets_map.Get(marked[i]);
+    interval_tree.insert(Interval<uint64_t, size_t>(offsets.Begin, offsets.End, i));
+  }
 
-      prev = decl;
+  std::vector<Interval<uint64_t, size_t>> outer;
+  for (size_t i = 0; i < marked.size(); i++) {
+    Decl *decl = marked[i];
+    DeclOffsetsMap::DeclOffsets offsets = offsets_map.Get(decl);
+
+    /*
+     * Check if there wasn't any symbol that is being defined in the same
+     * interval and remove it. Otherwise we might clash the types.
+     *
+     * One example of how this can happen is then we have something like
+     *
+     * typedef struct {
+     * ...
+     * } x, y;
+     *
+     * In the process of creating the closure we might reach the following
+     * situation:
+     *
+     * typdef struct {
+     * ...
+     * } x;
+     *
+     * typedef struct {
+     *
+     * } x, y;
+     *
+     * Which then breaks the one-definition-rule. In such cases, remove the
+     * previous declaration in the same code range, since the later will
+     * contain both definitions either way.
+     *
+     * Also be careful to make sure those declarations will be print as
+     * based on the source text and not in AST dump.  In the later case
+     * we don't want to remove it.
+     */
+    interval_tree.findOuterIntervals(Interval<uint64_t, size_t>(offsets.Begin,
+                                                                offsets.End, i),
+                                     outer);
+    for (const Interval<uint64_t, size_t> &interval : outer) {
+      /* Only a later decl in the translation unit can replace this one.  */
+      if (interval.value > i &&
+          offsets_map.Has_Source_Text(decl) &&
+          offsets_map.Has_Source_Text(marked[interval.value])) {
+        closure.Remove_Decl(decl);
+        break;
+      }
     }
   }
 }
 
 void FunctionDependencyFinder::Insert_Decls_From_Non_Expanded_Includes(void)
 {
+  /* Cache if an IncludeNode or any of its parents is marked for output, so
+     every node of the tree is walked at most once.  */
+  llvm::DenseMap<IncludeNode *, bool> kept_cache;
+  auto is_kept = [&kept_cache](IncludeNode *node) {
+    SmallVector<IncludeNode *, 16> path;
+    bool kept = false;
+
+    for (; node != nullptr; node = node->Get_Parent()) {
+      auto it = kept_cache.find(node);
+      if (it != kept_cache.end()) {
+        kept = it->second;
+        break;
+      }
+
+      path.push_back(node);
+      if (node->Should_Be_Output()) {
+        kept = true;
+        break;
+      }
+    }
+
+    for (IncludeNode *n : path) {
+      kept_cache[n] = kept;
+    }
+    return kept;
+  };
+
   ASTUnit::top_level_iterator it;
   for (it = AST->top_level_begin(); it != AST->top_level_end(); ++it) {
     Decl *decl = *it;
@@ -270,7 +383,7 @@ void FunctionDependencyFinder::Insert_Decls_From_Non_Expanded_Includes(void)
     const SourceLocation &loc = decl->getLocation();
     IncludeNode *node = IT.Get(loc);
 
-    if (node && node->Has_Parent_Marked_For_Output()) {
+    if (node && is_kept(node)) {
       Visitor.TraverseDecl(decl);
     }
   }
@@ -300,3 +413,41 @@ bool FunctionDependencyFinder::Run_Analysis(std::vector<std::string> const &func
 
   return ret;
 }
+
+void FunctionDependencyFinder::Collect_Dependencies(std::set<std::string> &deps)
+{
+  /* A file contributes to the output if a marked decl or macro is in it, and
+     so does every file in its chain of includes.  Walk the chain up to the
+     first node already seen.  */
+  llvm::DenseSet<IncludeNode *> visited;
+  auto add = [&](const SourceLocation &loc) {
+    for (IncludeNode *node = IT.Get(loc); node != nullptr; node = node->Get_Parent()) {
+      if (!visited.insert(node).second) {
+        break;
+      }
+      if (OptionalFileEntryRef file = node->Get_FileEntry()) {
+        deps.insert(file->getName().str());
+      }
+    }
+  };
+
+  for (Decl *decl : Visitor.Get_Closure().Get_Set()) {
+    add(decl->getLocation());
+  }
+
+  Preprocessor &pp = AST->getPreprocessor();
+  PreprocessingRecord *rec = pp.getPreprocessingRecord();
+  if (rec == nullptr) {
+    return;
+  }
+
+  MacroWalker mw(pp);
+  for (PreprocessedEntity *entity : *rec) {
+    if (MacroDefinitionRecord *def = dyn_cast<MacroDefinitionRecord>(entity)) {
+      MacroInfo *info = mw.Get_Macro_Info(def);
+      if (info && info->isUsed() && !mw.Is_Builtin_Macro(info)) {
+        add(def->getLocation());
+      }
+    }
+  }
+}
@@ -63,6 +63,11 @@ class FunctionDependencyFinder
     /** Run the analysis on function `function`*/
     bool Run_Analysis(std::vector<std::string> const &function);
 
+    /** Insert into deps the path of the files which contributed a marked decl
+        or macro, and of the files which include them.  Must be called before
+        Print, which unmarks what is provided by non-expanded includes.  */
+    void Collect_Dependencies(std::set<std::string> &deps);
+
   protected:
 
     /** Given a list of functions in `funcnames`, compute the closure of those
@@ -87,6 +92,9 @@ class FunctionDependencyFinder
     /* Should we keep the includes when printing?  */
     bool KeepIncludes;
 
+    /* Number of threads used to compute the closure.  */
+    unsigned Jobs;
+
     /* Visitor that sweeps through the AST.  Kept as pointer to avoid declaring
        the DeclClosureVisitor class into this .h to speedup build time.  */
     DeclClosureVisitor Visitor;
@@ -52,6 +52,19 @@ bool FunctionExternalizeFinder::Should_Externalize(const DeclaratorDecl *decl)
   if (!decl)
     return false;
 
+  auto it = Verdicts.find(decl);
+  if (it != Verdicts.end()) {
+    return it->second;
+  }
+
+  bool verdict = Compute_Should_Externalize(decl);
+  Verdicts[decl] = verdict;
+  return verdict;
+}
+
+bool FunctionExternalizeFinder::Compute_Should_Externalize(const DeclaratorDecl *decl)
+{
+
   if (Must_Not_Externalize(decl)) {
     return false;
   }
@@ -136,7 +149,8 @@ bool FunctionExternalizeFinder::Analyze_Node(CallGraphNode *node)
   if (Analyze_Function(decl)) {
     return true;
   } else {
-    /* Continue looking.  */
+    /* Continue looking.  Only now the callees of node are needed.  */
+    Graph.Expand(node);
     CallGraphNode::const_iterator child_it;
     for (child_it = node->begin(); child_it != node->end(); ++child_it) {
       CallGraphNode *child = child_it->Callee;
@@ -166,47 +180,95 @@ bool FunctionExternalizeFinder::Externalize_DeclRefs(Stmt *stmt)
   if (!stmt)
     return false;
 
-  bool externalized = false;
+  /* Collect the decls referenced in stmt which were not seen before.  Walk
+     the statements with a worklist rather than recursively, as bodies can be
+     deeply nested.  */
+  SmallVector<const DeclaratorDecl *, 32> candidates;
+  SmallVector<Stmt *, 64> worklist;
+  worklist.push_back(stmt);
 
-  if (DeclRefExpr::classof(stmt)) {
-    DeclRefExpr *expr = (DeclRefExpr *) stmt;
-    DeclaratorDecl *decl = dynamic_cast<DeclaratorDecl *>(expr->getDecl());
+  while (!worklist.empty()) {
+    Stmt *s = worklist.pop_back_val();
 
-    if (Should_Externalize(decl)) {
-      externalized = Mark_For_Externalization(decl->getNameAsString());
+    if (DeclRefExpr *expr = dyn_cast<DeclRefExpr>(s)) {
+      DeclaratorDecl *decl = dyn_cast<DeclaratorDecl>(expr->getDecl());
+      if (decl && ReferencedDecls.insert(decl).second) {
+        candidates.push_back(decl);
+      }
+    }
+
+    for (Stmt *child : s->children()) {
+      if (child) {
+        worklist.push_back(child);
+      }
     }
   }
 
-  /* Iterate through the list of all children Statements and repeat the
-     process.  */
-  clang::Stmt::child_iterator it, it_end;
-  for (it = stmt->child_begin(), it_end = stmt->child_end();
-      it != it_end; ++it) {
+  /* Now decide on all of them at once.  Only global symbols are looked up in
+     the debuginfo, so resolve those in bulk first.  */
+  std::vector<std::string> symbols;
+  for (const DeclaratorDecl *decl : candidates) {
+    const VarDecl *var = dyn_cast<VarDecl>(decl);
+    if (isa<FunctionDecl>(decl) || (var && var->hasGlobalStorage())) {
+      symbols.push_back(decl->getName().str());
+    }
+  }
+  IA.Resolve_Symbols(symbols);
 
-    Stmt *child = *it;
-    externalized |= Externalize_DeclRefs(child);
+  bool externalized = false;
+  for (const DeclaratorDecl *decl : candidates) {
+    if (Should_Externalize(decl)) {
+      externalized |= Mark_For_Externalization(decl->getName().str());
+    }
   }
 
   return externalized;
 }
 
-void FunctionExternalizeFinder::Run_Analysis(void)
+void FunctionExternalizeFinder::Analyze_Roots(Decl *decl)
 {
-  //CallGraphWithBodylessFunctions *cg = Build_CallGraph_From_AST(AST);
-  CallGraph *cg = Build_CallGraph_From_AST(AST);
-
-  for (auto it = cg->begin(); it != cg->end(); ++it) {
-    CallGraphNode *node = (*it).getSecond().get();
-    if (node->getDecl()) {
-      if (FunctionDecl *func = node->getDefinition()) {
-        if (Should_Extract(func)) {
-          Analyze_Node(node);
-        }
-      }
+  if (FunctionDecl *func = dyn_cast<FunctionDecl>(decl)) {
+    if (func->getIdentifier() && func->doesThisDeclarationHaveABody() &&
+        Should_Extract(func)) {
+      Analyze_Node(Graph.Get_Node(func));
+    }
+    return;
+  }
+
+  if (FunctionTemplateDecl *tmpl = dyn_cast<FunctionTemplateDecl>(decl)) {
+    for (FunctionDecl *spec : tmpl->specializations()) {
+      Analyze_Roots(spec);
+    }
+    return;
+  }
+
+  if (ClassTemplateDecl *tmpl = dyn_cast<ClassTemplateDecl>(decl)) {
+    for (ClassTemplateSpecializationDecl *spec : tmpl->specializations()) {
+      Analyze_Roots(spec);
+    }
+    return;
+  }
+
+  /* Functions to extract may be declared in namespaces or be methods.  */
+  if (isa<NamespaceDecl>(decl) || isa<LinkageSpecDecl>(decl) ||
+      isa<CXXRecordDecl>(decl)) {
+    for (Decl *child : cast<DeclContext>(decl)->decls()) {
+      Analyze_Roots(child);
     }
   }
+}
 
-  delete cg;
+void FunctionExternalizeFinder::Run_Analysis(void)
+{
+  /* Start from the functions to extract instead of building the CallGraph of
+     the entire AST.  Only the edges are computed on demand.
+
+     Sweep the toplevel decls to find them rather than using DeclContext::lookup,
+     which may miss the Decl that has the body of the function (see
+     DeclClosureVisitor::Compute_Closure_Of_Symbols).  */
+  for (auto it = AST->top_level_begin(); it != AST->top_level_end(); ++it) {
+    Analyze_Roots(*it);
+  }
 }
 
 std::vector<std::string> FunctionExternalizeFinder::Get_To_Externalize(void)
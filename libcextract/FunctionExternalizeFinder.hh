@@ -27,6 +27,7 @@
 #include "clang/Analysis/CallGraph.h"
 #include "clang/Frontend/ASTUnit.h"
 #include "InlineAnalysis.hh"
+#include "LLVMMisc.hh"
 
 #include <vector>
 #include <unordered_set>
@@ -43,6 +44,9 @@ class FunctionExternalizeFinder
                             InlineAnalysis &IA);
 
   bool Should_Externalize(CallGraphNode *node);
+
+  /** Check if decl should be externalized.  The verdict is computed once per
+      decl.  */
   bool Should_Externalize(const DeclaratorDecl *decl);
 
   void Run_Analysis(void);
@@ -54,9 +58,16 @@ class FunctionExternalizeFinder
   bool Analyze_Node(CallGraphNode *);
   bool Analyze_Function(FunctionDecl *);
 
+  /** Analyze the definitions of the functions to extract found in decl,
+      looking into namespaces and classes.  */
+  void Analyze_Roots(Decl *decl);
+
   bool Externalize_DeclRefs(FunctionDecl *decl);
   bool Externalize_DeclRefs(Stmt *stmt);
 
+  /** Compute the verdict of Should_Externalize.  */
+  bool Compute_Should_Externalize(const DeclaratorDecl *decl);
+
   inline bool Must_Not_Externalize(const std::string &name)
   {
     return MustNotExternalize.find(name) != MustNotExternalize.end();
@@ -107,4 +118,14 @@ class FunctionExternalizeFinder
   bool KeepIncludes;
   ASTUnit *AST;
   InlineAnalysis &IA;
+
+  /* Call graph of the functions reachable from the ones to extract.  */
+  LazyCallGraph Graph;
+
+  /* Decls already found in a DeclRefExpr.  Those were already checked, so
+     further references to them can be skipped.  */
+  llvm::DenseSet<const DeclaratorDecl *> ReferencedDecls;
+
+  /* Memoized verdicts of Should_Externalize.  */
+  llvm::DenseMap<const DeclaratorDecl *, bool> Verdicts;
 };
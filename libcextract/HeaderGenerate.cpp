@@ -1,4 +1,4 @@
-//===- HeaderGenerate.hh - Output a header file for generated output. *- C++ -*-===//
+//===- HeaderGenerate.cpp - Output a header file for generated output. *- C++ -*-===//
 //
 // This project is licensed under the Apache License v2.0 with LLVM Exceptions.
 // See https://llvm.org/LICENSE.txt for license information.
@@ -14,8 +14,6 @@
 /* Author: Giuliano Belinassi  */
 
 #include "HeaderGenerate.hh"
-#include "FunctionDepsFinder.hh"
-#include "IncludeTree.hh"
 #include "PrettyPrint.hh"
 
 HeaderGeneration::HeaderGeneration(PassManager::Context *ctx)
@@ -26,52 +24,45 @@ HeaderGeneration::HeaderGeneration(PassManager::Context *ctx)
 
 void HeaderGeneration::Print(void)
 {
-  IncludeTree IT(AST); // Not necessary, just to use the RecursivePrint class.
-  RecursivePrint(AST, Closure.Get_Set(), IT, false).Print();
+  DeclPrint printer(AST);
+  for (FunctionDecl *fdecl : Prototypes) {
+    printer.Print_With_Location(fdecl);
+  }
 }
 
-static bool Contains(const std::vector<ExternalizerLogEntry> &v, const std::string &name)
+bool HeaderGeneration::Run_Analysis(const std::vector<ExternalizerLogEntry> &set)
 {
-  for (const ExternalizerLogEntry &x : v) {
-    if ((x.Type == ExternalizationType::RENAME || x.Type == ExternalizationType::WEAK)
-        && x.NewName == name) {
-      return true;
+  /* Index the names of the externalized functions, as every function in the
+     AST is checked against it.  */
+  llvm::StringSet<> names;
+  for (const ExternalizerLogEntry &x : set) {
+    if (x.Type == ExternalizationType::RENAME || x.Type == ExternalizationType::WEAK) {
+      names.insert(x.NewName);
     }
   }
 
-  return false;
-}
+  if (names.empty()) {
+    return true;
+  }
 
-bool HeaderGeneration::Run_Analysis(const std::vector<ExternalizerLogEntry> &set)
-{
   ASTUnit::top_level_iterator it;
-  std::unordered_set<std::string> nameset;
-
   for (it = AST->top_level_begin(); it != AST->top_level_end(); ++it) {
-    Decl *decl = *it;
+    FunctionDecl *fdecl = dyn_cast<FunctionDecl>(*it);
+    if (fdecl == nullptr || !fdecl->getDeclName().isIdentifier()) {
+      continue;
+    }
 
-    if (FunctionDecl *fdecl = dyn_cast<FunctionDecl>(decl)) {
-      const std::string &fname = fdecl->getNameAsString();
-      /* If the function was already issued, then do not issue it again.  */
-      if (Contains(set, fname) && nameset.find(fname) == nameset.end()) {
-        if (fdecl->doesThisDeclarationHaveABody() && fdecl->hasBody()) {
-          Stmt *body = fdecl->getBody();
-          fdecl->setRangeEnd(body->getBeginLoc().getLocWithOffset(-1));
-          fdecl->setBody(nullptr);
-        }
-        Closure.Add_Single_Decl(fdecl);
-        nameset.insert(fname);
+    /* If the function was already issued, then do not issue it again.  */
+    if (names.erase(fdecl->getName())) {
+      if (fdecl->doesThisDeclarationHaveABody() && fdecl->hasBody()) {
+        Stmt *body = fdecl->getBody();
+        fdecl->setRangeEnd(body->getBeginLoc().getLocWithOffset(-1));
+        fdecl->setBody(nullptr);
       }
-    }
-  }
+      Prototypes.push_back(fdecl);
 
-  /* Do not output any macros.  */
-  MacroWalker mw(AST->getPreprocessor());
-  PreprocessingRecord *rec = AST->getPreprocessor().getPreprocessingRecord();
-  for (PreprocessedEntity *entity : *rec) {
-    if (MacroDefinitionRecord *def = dyn_cast<MacroDefinitionRecord>(entity)) {
-      if (MacroInfo *info = mw.Get_Macro_Info(def)) {
-        info->setIsUsed(false);
+      if (names.empty()) {
+        break;
       }
     }
   }
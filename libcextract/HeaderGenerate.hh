@@ -16,15 +16,19 @@
 #pragma once
 
 #include "Passes.hh"
-#include "FunctionDepsFinder.hh"
 #include "SymbolExternalizer.hh"
 
+#include <llvm/ADT/StringSet.h>
+
 
 using namespace clang;
 
 /** Outputs a header file with a foward declarations of all functions in the current
  *  AST.
  *
+ *  Only the prototypes are printed, so there is no need to compute an
+ *  IncludeTree nor to walk the translation unit through RecursivePrint.
+ *
  *  WARNING:  This class modifies the AST.
  */
 class HeaderGeneration
@@ -38,5 +42,7 @@ class HeaderGeneration
 
   protected:
   ASTUnit *AST;
-  ClosureSet Closure;
+
+  /* Functions to output, in the order they appear in the AST.  */
+  std::vector<FunctionDecl *> Prototypes;
 };
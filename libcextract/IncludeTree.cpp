@@ -38,11 +38,11 @@ static bool In_Set(std::unordered_set<std::string> &set, const std::string &str,
 /* ----- IncludeTree ------ */
 IncludeTree::IncludeTree(Preprocessor &pp,
                          SourceManager &sm,
-                         IncludeExpansionPolicy::Policy p,
+                         std::shared_ptr<IncludeExpansionPolicy> policy,
                          std::vector<std::string> const &must_expand)
   : PP(pp),
     SM(sm),
-    IEP(IncludeExpansionPolicy::Get_Expansion_Policy_Unique(p))
+    IEP(policy)
 {
   Build_Header_Tree(must_expand);
   Fix_Output_Attrs(Root);
@@ -182,31 +182,14 @@ void IncludeTree::Build_Header_Tree(std::vector<std::string> const &must_expand)
 
 void IncludeTree::Build_Header_Map(void)
 {
-  static bool warned = false;
   std::stack<IncludeNode *> stack;
 
+  /* For InclusionDirectives.  */
   stack.push(Root);
   while (!stack.empty()) {
     IncludeNode *node = stack.top();
     stack.pop();
 
-    /* For Files.  */
-    OptionalFileEntryRef file = node->Get_FileEntry();
-    const FileEntry *fentry = &file->getFileEntry();
-    if (Map.find(fentry) != Map.end()) {
-      /* FIXME: Find a way to correcly map the FileEntry to the node instead of
-         discarding future appearances.  */
-      if (warned == false) {
-        const SourceRange &range = node->Get_Include_Spelling_Range();
-        DiagsClass::Emit_Warn("project #include's the same file multiple times."
-                              " Only the first is registered.", range);
-        warned = true;
-      }
-    } else {
-      Map[fentry] = node;
-    }
-
-    /* For InclusionDirectives.  */
     if (node->ID != nullptr) {
       IncMap[node->ID] = node;
     }
@@ -216,6 +199,45 @@ void IncludeTree::Build_Header_Map(void)
       stack.push(node->Get_Child(--n));
     }
   }
+
+  /* For Files.  Every time a file is entered the SourceManager creates a new
+     FileID whose IncludeLoc points to the file name in the #include which
+     entered it.  Map it to the node of that #include.  */
+  FileMap.assign(SM.local_sloc_entry_size(), nullptr);
+  for (unsigned i = 0; i < FileMap.size(); i++) {
+    FileMap[i] = Find_Node_Of_Entry(SM.getLocalSLocEntry(i));
+  }
+
+  /* Loaded entries are mapped lazily in Get, else we would deserialize every
+     entry of the preamble.  */
+
+  FileMap[SM.getMainFileID().getHashValue()] = Root;
+}
+
+IncludeNode *IncludeTree::Find_Node_Of_Entry(const SrcMgr::SLocEntry &entry)
+{
+  if (!entry.isFile()) {
+    return nullptr;
+  }
+
+  SourceLocation include_loc = entry.getFile().getIncludeLoc();
+  if (include_loc.isInvalid()) {
+    return nullptr;
+  }
+
+  PreprocessingRecord *rec = PP.getPreprocessingRecord();
+  auto entities = rec->getPreprocessedEntitiesInRange(
+                                    SourceRange(include_loc, include_loc));
+  for (PreprocessedEntity *entity : entities) {
+    if (InclusionDirective *directive = dyn_cast<InclusionDirective>(entity)) {
+      auto it = IncMap.find(directive);
+      if (it != IncMap.end()) {
+        return it->second;
+      }
+    }
+  }
+
+  return nullptr;
 }
 
 void IncludeTree::Fix_Output_Attrs(IncludeNode *node)
@@ -233,22 +255,41 @@ void IncludeTree::Fix_Output_Attrs(IncludeNode *node)
 
 IncludeNode *IncludeTree::Get(const SourceLocation &loc)
 {
-  OptionalFileEntryRef fileref = PrettyPrint::Get_FileEntry(loc);
+  if (loc.isInvalid()) {
+    return nullptr;
+  }
+
+  /* Macro locations are in the FileID of the expansion, which is not a file.
+     Use the file where the macro was expanded.  */
+  if (loc.isMacroID()) {
+    return Get(SM.getFileID(SM.getExpansionLoc(loc)));
+  }
+
+  return Get(SM.getFileID(loc));
+}
+
+IncludeNode *IncludeTree::Get(const FileID &id)
+{
+  int value = id.getHashValue();
 
-  /* In case we could not find a FileRef, then try the ExpansionLoc.  */
-  if (!fileref.has_value()) {
-    SourceManager *SM = PrettyPrint::Get_Source_Manager();
-    const SourceLocation &loc2 = SM->getExpansionLoc(loc);
-    fileref = PrettyPrint::Get_FileEntry(loc2);
+  if (value >= 0) {
+    if ((unsigned)value < FileMap.size()) {
+      return FileMap[value];
+    }
+    return nullptr;
   }
 
-  if (fileref.has_value()) {
-    const FileEntry *file = &fileref->getFileEntry();
-    return Map[file];
+  /* Loaded FileIDs (e.g. from a preamble) are negative.  */
+  auto it = LoadedFileMap.find(value);
+  if (it != LoadedFileMap.end()) {
+    return it->second;
   }
 
-  /* Well, the declaration seems fuzzy, so return that we don't have a file.  */
-  return nullptr;
+  bool invalid = false;
+  const SrcMgr::SLocEntry &entry = SM.getSLocEntry(id, &invalid);
+  IncludeNode *node = invalid ? nullptr : Find_Node_Of_Entry(entry);
+  LoadedFileMap[value] = node;
+  return node;
 }
 
 void IncludeTree::Dump(void)
@@ -256,8 +297,9 @@ void IncludeTree::Dump(void)
   Root->Dump();
 
   llvm::outs() << "Tree map:\n";
-  for (auto &p: Map)
-    llvm::outs() << " " << p.first << " => " << p.second << '\n';
+  for (unsigned i = 0; i < FileMap.size(); i++)
+    if (FileMap[i])
+      llvm::outs() << " " << i << " => " << FileMap[i] << '\n';
 }
 
 /* ----- IncludeNode ------ */
@@ -449,7 +491,11 @@ std::unique_ptr<std::vector<IncludeNode *>> IncludeTree::Get_Includes(void)
 
 IncludeNode *IncludeTree::Get(const InclusionDirective *directive)
 {
-  return IncMap[directive];
+  auto it = IncMap.find(directive);
+  if (it != IncMap.end()) {
+    return it->second;
+  }
+  return nullptr;
 }
 
 bool IncludeNode::Has_Parent_Marked_For_Output(void)
@@ -526,7 +572,7 @@ bool IncludeNode::Is_Reachable_From_Main(void)
 
   if (ref.has_value()) {
     const FileEntry &entry = (*ref).getFileEntry();
-    if (Tree.IEP->Must_Expand(entry.tryGetRealPathName(), entry.getName())) {
+    if (Tree.IEP->Must_Expand_File(entry)) {
       /* Lie telling it is unreachable, which would force an expansion.  */
       return false;
     }
@@ -26,6 +26,7 @@
 #include "ExpansionPolicy.hh"
 
 #include <clang/Tooling/Tooling.h>
+#include <llvm/ADT/DenseMap.h>
 #include <vector>
 #include <unordered_map>
 #include <memory>
@@ -183,9 +184,25 @@ class IncludeTree
 
   /** Create the include tree from the Preprocessor history.  */
   IncludeTree(Preprocessor &pp, SourceManager &sm,
-              IncludeExpansionPolicy::Policy p = IncludeExpansionPolicy::Policy::NOTHING,
+              std::shared_ptr<IncludeExpansionPolicy> policy,
               std::vector<std::string> const &must_expand = {});
 
+  IncludeTree(Preprocessor &pp, SourceManager &sm,
+              IncludeExpansionPolicy::Policy p = IncludeExpansionPolicy::Policy::NOTHING,
+              std::vector<std::string> const &must_expand = {})
+    : IncludeTree(pp, sm, IncludeExpansionPolicy::Get_Expansion_Policy_Shared(p),
+                  must_expand)
+  {
+  }
+
+  IncludeTree(ASTUnit *ast,
+              std::shared_ptr<IncludeExpansionPolicy> policy,
+              std::vector<std::string> const &must_expand = {})
+    : IncludeTree(ast->getPreprocessor(), ast->getSourceManager(), policy,
+                  must_expand)
+  {
+  }
+
   IncludeTree(ASTUnit *ast,
               IncludeExpansionPolicy::Policy p = IncludeExpansionPolicy::Policy::NOTHING,
               std::vector<std::string> const &must_expand = {})
@@ -202,9 +219,13 @@ class IncludeTree
   /** Get all includes.  */
   std::unique_ptr<std::vector<IncludeNode *>> Get_Includes(void);
 
-  /* Get from SourceLocation.  */
+  /** Get from SourceLocation.  Macro locations are mapped to the file where
+      they were expanded.  */
   IncludeNode *Get(const SourceLocation &loc);
 
+  /** Get the node of the inclusion which created FileID.  */
+  IncludeNode *Get(const FileID &id);
+
   /** Get from InclusionDirective.  */
   IncludeNode *Get(const InclusionDirective *);
 
@@ -216,9 +237,12 @@ class IncludeTree
   /** Actually builds the header tree.  */
   void Build_Header_Tree(std::vector<std::string> const &must_expand);
 
-  /** Build mapping from header path to IncludeNode.  */
+  /** Build mapping from FileID and InclusionDirective to IncludeNode.  */
   void Build_Header_Map(void);
 
+  /** Find the node of the #include which entered the file of entry.  */
+  IncludeNode *Find_Node_Of_Entry(const SrcMgr::SLocEntry &entry);
+
   /** Fix the case where the IncludeNode can not be marked to output and needs
       to be expanded because it is not reachable from the main file.  */
   void Fix_Output_Attrs(IncludeNode *node);
@@ -226,8 +250,16 @@ class IncludeTree
   /** Root of the tree.  */
   IncludeNode *Root;
 
-  /* Hash mapping included file to IncludeNode.  */
-  std::unordered_map<const FileEntry *, IncludeTree::IncludeNode *> Map;
+  /* Mapping of local FileIDs to IncludeNode, indexed by the FileID's hash
+     value.  Each inclusion of a file gets its own FileID, so files which are
+     included multiple times are mapped to the correct node.  */
+  std::vector<IncludeTree::IncludeNode *> FileMap;
+
+  /* Mapping of loaded FileIDs (e.g. from a preamble) to IncludeNode.  Filled
+     on demand, as querying a loaded entry deserializes it.  */
+  llvm::DenseMap<int, IncludeTree::IncludeNode *> LoadedFileMap;
+
+  /* Hash mapping InclusionDirective to IncludeNode.  */
   std::unordered_map<const InclusionDirective *, IncludeTree::IncludeNode *> IncMap;
 
   /** Reference to the preprocessor used by compilation.  */
@@ -236,8 +268,9 @@ class IncludeTree
   /** Reference to the SourceManager.  */
   SourceManager &SM;
 
-  /** The Include Expansion Policy when expanding includes.  */
-  std::unique_ptr<IncludeExpansionPolicy> IEP;
+  /** The Include Expansion Policy when expanding includes.  May be shared
+      with other trees.  */
+  std::shared_ptr<IncludeExpansionPolicy> IEP;
 };
 
 typedef IncludeTree::IncludeNode IncludeNode;
@@ -292,22 +292,33 @@ static const char *Bind(unsigned link)
   }
 }
 
-ExternalizationType InlineAnalysis::Needs_Externalization(const std::string &sym)
+SymbolResolution InlineAnalysis::Compute_Resolution(const std::string &sym)
 {
+  SymbolResolution res = { .Info = 0, .Type = ExternalizationType::NONE,
+                           .Module = {} };
+
+  /* Look into each table once, and derive everything from that.  */
   if (Symv) {
-    const std::string &sym_mod = Symv->Get_Symbol_Module(sym);
-    /*
-     * If the symbol exists on Symvers we can decide whether the symbol must be
-     * externalized or not, and not rely on ELF.
-     */
-    if (!sym_mod.empty())
-      return (Symv->Needs_Externalization(sym_mod)) ? ExternalizationType::STRONG
-                                                    : ExternalizationType::NONE;
-  }
-
-  unsigned char info = Get_Symbol_Info(sym);
-  if (info > 0) {
-    unsigned bind = ElfSymbol::Bind_Of(info);
+    res.Module = Symv->Get_Symbol_Module(sym);
+  }
+  res.Info = Get_Symbol_Info(sym);
+
+  /*
+   * If the symbol exists on Symvers we can decide whether the symbol must be
+   * externalized or not, and not rely on ELF.
+   */
+  if (!res.Module.empty()) {
+    res.Type = (Symv->Needs_Externalization(res.Module)) ? ExternalizationType::STRONG
+                                                         : ExternalizationType::NONE;
+    return res;
+  }
+
+  if (Have_Debuginfo()) {
+    res.Module = ElfCache->Get_Symbol_Module(sym);
+  }
+
+  if (res.Info > 0) {
+    unsigned bind = ElfSymbol::Bind_Of(res.Info);
     switch (bind) {
       case STB_GLOBAL:
         /*
@@ -317,23 +328,53 @@ ExternalizationType InlineAnalysis::Needs_Externalization(const std::string &sym
          * it.
          */
         if (Kernel) {
-          return ExternalizationType::STRONG;
+          res.Type = ExternalizationType::STRONG;
+        } else {
+          res.Type = ExternalizationType::WEAK;
         }
-        return ExternalizationType::WEAK;
         break;
       case STB_LOCAL:
-        return ExternalizationType::STRONG;
+        res.Type = ExternalizationType::STRONG;
         break;
 
       case STB_WEAK:
       default:
-        return ExternalizationType::NONE;
+        res.Type = ExternalizationType::NONE;
         break;
     }
   }
 
   /* No debuginfo provided, there is nothing we can do.  */
-  return ExternalizationType::NONE;
+  return res;
+}
+
+const SymbolResolution &InlineAnalysis::Resolve_Symbol(const std::string &sym)
+{
+  auto it = Resolved.find(sym);
+  if (it != Resolved.end()) {
+    return it->second;
+  }
+
+  return Resolved.emplace(sym, Compute_Resolution(sym)).first->second;
+}
+
+std::vector<const SymbolResolution *>
+InlineAnalysis::Resolve_Symbols(const std::vector<std::string> &syms)
+{
+  std::vector<const SymbolResolution *> table;
+  table.reserve(syms.size());
+  Resolved.reserve(Resolved.size() + syms.size());
+
+  for (const std::string &sym : syms) {
+    table.push_back(&Resolve_Symbol(sym));
+  }
+
+  return table;
+}
+
+ExternalizationType InlineAnalysis::Needs_Externalization(const std::string &sym)
+{
+  return Resolve_Symbol(sym).Type;
 }
 
 bool InlineAnalysis::Is_Externally_Visible(const std::string &sym)
@@ -370,6 +411,26 @@ std::set<std::string> InlineAnalysis::Get_All_Symbols(void)
   return set;
 }
 
+std::vector<std::string> InlineAnalysis::Get_Input_Files(void)
+{
+  std::vector<std::string> files;
+
+  if (ElfObj) {
+    files.push_back(ElfObj->Get_Path());
+  }
+
+  if (Ipa) {
+    const std::vector<std::string> &ipa_files = Ipa->Get_Parsed_Files();
+    files.insert(files.end(), ipa_files.begin(), ipa_files.end());
+  }
+
+  if (Symv) {
+    files.push_back(Symv->Get_Path());
+  }
+
+  return files;
+}
+
 void InlineAnalysis::Print_Symbol_Set(const std::set<std::string> &symbol_set,
                                       bool csv, FILE *out)
 {
@@ -488,17 +549,7 @@ const char *InlineAnalysis::Demangle_Symbol(const char *symbol)
  * Check if Kernel module was found on Symvers or ELF object. Returns empty is
  * the module was not found, or if the LP is not from a kernel source.
  */
-std::string InlineAnalysis::Get_Symbol_Module(std::string sym)
+std::string InlineAnalysis::Get_Symbol_Module(const std::string &sym)
 {
-  std::string mod;
-  if (Symv) {
-    mod = Symv->Get_Symbol_Module(sym);
-    if (!mod.empty())
-      return mod;
-  }
-
-  if (Have_Debuginfo())
-    return ElfCache->Get_Symbol_Module(sym);
-
-  return {};
+  return Resolve_Symbol(sym).Module;
 }
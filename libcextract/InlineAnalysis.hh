@@ -29,6 +29,7 @@
 
 #include <set>
 #include <string>
+#include <unordered_map>
 #include <vector>
 #include <stdio.h>
 
@@ -41,6 +42,19 @@ enum ExternalizationType {
   RENAME=100, /* Used to indicate that the function only requires a rename.  */
 };
 
+/** What the debuginfo and symvers say about a symbol.  */
+struct SymbolResolution
+{
+  /** ELF info of the symbol, or 0 if it is not in the debuginfo.  */
+  unsigned char Info;
+
+  /** Externalization needed by the symbol.  */
+  ExternalizationType Type;
+
+  /** Module where the symbol is, or empty if unknown.  */
+  std::string Module;
+};
+
 class InlineAnalysis
 {
   public:
@@ -78,6 +92,15 @@ class InlineAnalysis
 
   ExternalizationType Needs_Externalization(const std::string &sym);
 
+  /** Resolve every symbol in syms at once and return what is known about
+      each of them, in the same order.  Results are memoized, so every pass
+      sharing this object gets them without looking into the symbol tables
+      again.  */
+  std::vector<const SymbolResolution *> Resolve_Symbols(const std::vector<std::string> &syms);
+
+  /** Same as Resolve_Symbols, for a single symbol.  */
+  const SymbolResolution &Resolve_Symbol(const std::string &sym);
+
   /** Check if symbol is externally visible.  */
   bool Is_Externally_Visible(const std::string &sym);
 
@@ -115,6 +138,9 @@ class InlineAnalysis
     return Have_Debuginfo() || Have_Symvers();
   }
 
+  /** Get the path of every debuginfo, ipa-clones and symvers file read.  */
+  std::vector<std::string> Get_Input_Files(void);
+
   /** Dump for debugging concerns.  */
   void Dump(void);
 
@@ -135,12 +161,19 @@ class InlineAnalysis
     return Demangle_Symbol(symbol.c_str());
   }
 
-  std::string Get_Symbol_Module(std::string sym);
+  std::string Get_Symbol_Module(const std::string &sym);
 
   private:
   /** Put color information in the graphviz .DOT file.  */
   void Print_Node_Colors(const std::set<IpaCloneNode *> &set, FILE *fp);
 
+  /** Look sym up in the symvers and debuginfo.  */
+  SymbolResolution Compute_Resolution(const std::string &sym);
+
+  /** Memoized results of Resolve_Symbol.  Nodes are never removed, so
+      pointers to the resolutions remain valid.  */
+  std::unordered_map<std::string, SymbolResolution> Resolved;
+
   ElfObject *ElfObj;
   ElfSymbolCache *ElfCache;
   IpaClones *Ipa;
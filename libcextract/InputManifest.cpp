@@ -0,0 +1,188 @@
+//===- InputManifest.cpp - Record the inputs of a run ---------- *- C++ -*-===//
+//
+// This project is licensed under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+/// \file
+/// Record the inputs of a successful run, so an identical run can be skipped.
+//
+//===----------------------------------------------------------------------===//
+
+/* Author: Giuliano Belinassi  */
+
+#include "InputManifest.hh"
+
+#include <clang/Basic/Version.h>
+#include <llvm/ADT/StringExtras.h>
+#include <llvm/ADT/StringRef.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/LineIterator.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/raw_ostream.h>
+#include <llvm/Support/xxhash.h>
+
+using namespace llvm;
+
+std::string InputManifest::Get_Path(const std::string &output)
+{
+  return output + ".manifest";
+}
+
+std::string InputManifest::Get_Tool_Version(void)
+{
+  std::string version = clang::getClangFullVersion();
+
+  /* The version of clang-extract itself does not change between builds, but
+     the executable does.  */
+  std::string exe = sys::fs::getMainExecutable(nullptr,
+                                               (void *)&InputManifest::Get_Path);
+  sys::fs::file_status status;
+  if (!exe.empty() && !sys::fs::status(exe, status)) {
+    version += ' ' + exe;
+    version += ' ' + std::to_string(status.getSize());
+    version += ' ' + std::to_string(
+      status.getLastModificationTime().time_since_epoch().count());
+  }
+
+  return version;
+}
+
+uint64_t InputManifest::Hash_Command_Line(const std::vector<std::string> &args)
+{
+  std::string joined = Get_Tool_Version();
+  joined += '\0';
+  for (const std::string &arg : args) {
+    joined += arg;
+    joined += '\0';
+  }
+
+  return xxHash64(joined);
+}
+
+bool InputManifest::Hash_File(const std::string &path, uint64_t &hash,
+                              uint64_t &size)
+{
+  ErrorOr<std::unique_ptr<MemoryBuffer>> buffer =
+    MemoryBuffer::getFile(path, /*IsText=*/false,
+                          /*RequiresNullTerminator=*/false);
+  if (!buffer) {
+    return false;
+  }
+
+  StringRef contents = (*buffer)->getBuffer();
+  hash = xxHash64(contents);
+  size = contents.size();
+  return true;
+}
+
+bool InputManifest::Is_Up_To_Date(const std::string &path, uint64_t args_hash,
+                                  const std::vector<std::string> &products)
+{
+  for (const std::string &product : products) {
+    if (!sys::fs::exists(product)) {
+      return false;
+    }
+  }
+
+  ErrorOr<std::unique_ptr<MemoryBuffer>> buffer = MemoryBuffer::getFile(path);
+  if (!buffer) {
+    return false;
+  }
+
+  line_iterator it(**buffer, /*SkipBlanks=*/true);
+  if (it.is_at_eof() ||
+      *it != "clang-extract-manifest " + std::to_string(Version)) {
+    return false;
+  }
+  ++it;
+
+  uint64_t recorded_args;
+  StringRef line = it.is_at_eof() ? StringRef() : *it;
+  if (!line.consume_front("args ") || line.getAsInteger(16, recorded_args) ||
+      recorded_args != args_hash) {
+    return false;
+  }
+  ++it;
+
+  /* A manifest without files is not from a complete run.  */
+  if (it.is_at_eof()) {
+    return false;
+  }
+
+  for (; !it.is_at_eof(); ++it) {
+    line = *it;
+    if (!line.consume_front("file ")) {
+      return false;
+    }
+
+    StringRef hash_str, size_str, file;
+    std::tie(hash_str, line) = line.split(' ');
+    std::tie(size_str, file) = line.split(' ');
+
+    uint64_t recorded_hash, recorded_size;
+    if (hash_str.getAsInteger(16, recorded_hash) ||
+        size_str.getAsInteger(10, recorded_size) || file.empty()) {
+      return false;
+    }
+
+    /* Comparing the size first avoids reading files which clearly changed.  */
+    uint64_t size;
+    if (sys::fs::file_size(file, size) || size != recorded_size) {
+      return false;
+    }
+
+    uint64_t hash;
+    if (!Hash_File(file.str(), hash, size) || hash != recorded_hash) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+bool InputManifest::Write(const std::string &path, uint64_t args_hash,
+                          const std::vector<std::string> &files)
+{
+  /* Write into a temporary file and move it over, so an interrupted run never
+     leaves a manifest behind.  */
+  std::string temp_path = path + ".tmp";
+
+  {
+    std::error_code ec;
+    raw_fd_ostream out(temp_path, ec);
+    if (ec) {
+      return false;
+    }
+
+    out << "clang-extract-manifest " << Version << '\n';
+    out << "args " << utohexstr(args_hash) << '\n';
+
+    for (const std::string &file : files) {
+      uint64_t hash, size;
+      if (!Hash_File(file, hash, size)) {
+        out.close();
+        out.clear_error();
+        sys::fs::remove(temp_path);
+        return false;
+      }
+      out << "file " << utohexstr(hash) << ' ' << size << ' ' << file << '\n';
+    }
+
+    out.close();
+    if (out.has_error()) {
+      out.clear_error();
+      sys::fs::remove(temp_path);
+      return false;
+    }
+  }
+
+  return !sys::fs::rename(temp_path, path);
+}
+
+void InputManifest::Remove(const std::string &path)
+{
+  sys::fs::remove(path);
+}
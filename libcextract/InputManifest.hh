@@ -0,0 +1,73 @@
+//===- InputManifest.hh - Record the inputs of a run ----------- *- C++ -*-===//
+//
+// This project is licensed under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+/// \file
+/// Record the inputs of a successful run, so an identical run can be skipped.
+//
+//===----------------------------------------------------------------------===//
+
+/* Author: Giuliano Belinassi  */
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/** @brief Manifest of the inputs of a successful run.
+ *
+ * The manifest is a text file written next to the output, holding a hash of
+ * the command line and of the build of clang-extract, and the hash of every
+ * file the preprocessor entered while parsing the input, plus the analysis
+ * databases and the expansion rules.  If none of them changed then running
+ * again would produce the same output.
+ *
+ * Its format is:
+ *   clang-extract-manifest <version of the format>
+ *   args <hash of the command line and the tool>
+ *   file <hash> <size> <path>
+ *   ...
+ */
+class InputManifest
+{
+  public:
+  /** Get the path of the manifest of the output file.  */
+  static std::string Get_Path(const std::string &output);
+
+  /** Hash the command line together with the version of clang-extract, so a
+      rebuilt tool does not skip.  */
+  static uint64_t Hash_Command_Line(const std::vector<std::string> &args);
+
+  /** Check if the manifest at path was written by a run with the same command
+      line, and that neither the files it lists changed nor the products of
+      the run are missing.  */
+  static bool Is_Up_To_Date(const std::string &path, uint64_t args_hash,
+                            const std::vector<std::string> &products);
+
+  /** Write the manifest of a run into path.  Returns false if a file can not
+      be read or the manifest can not be written.  */
+  static bool Write(const std::string &path, uint64_t args_hash,
+                    const std::vector<std::string> &files);
+
+  /** Remove the manifest at path, if it exists.  */
+  static void Remove(const std::string &path);
+
+  private:
+  /** Hash the contents of the file at path.  Returns false if it can not be
+      read.  */
+  static bool Hash_File(const std::string &path, uint64_t &hash, uint64_t &size);
+
+  /** Get a string identifying this build of clang-extract: the clang it was
+      built with and the size and timestamp of the running executable.  */
+  static std::string Get_Tool_Version(void);
+
+  static constexpr unsigned Version = 1;
+
+  /* This class can not be initialized.  */
+  InputManifest() = delete;
+};
@@ -406,8 +406,6 @@ public:
         if (m_root != m_nill) {
             subtreeOverlappingIntervals(m_root, interval, boundary, Appender{out});
         }
-
-        out.shrink_to_fit();
     }
 
 
@@ -429,8 +427,6 @@ public:
         if (m_root != m_nill) {
             subtreeInnerIntervals(m_root, interval, boundary, Appender{out});
         }
-
-        out.shrink_to_fit();
     }
 
 
@@ -452,8 +448,6 @@ public:
         if (m_root != m_nill) {
             subtreeOuterIntervals(m_root, interval, boundary, Appender{out});
         }
-
-        out.shrink_to_fit();
     }
 
 
@@ -475,8 +469,6 @@ public:
         if (m_root != m_nill) {
             subtreeIntervalsContainPoint(m_root, point, boundary, Appender{out});
         }
-
-        out.shrink_to_fit();
     }
 
 
@@ -172,6 +172,7 @@ void IpaClones::Parse(const char *path)
   if (file == nullptr) {
     throw std::runtime_error("Unable to open ipa-clones file: " + std::string(path));
   }
+  ParsedFiles.push_back(path);
 
   char *line;
 
@@ -77,6 +77,12 @@ class IpaClones : public Parser
     : IpaClones(path.c_str())
   { }
 
+  /** Get the path of every .ipa-clones file which was parsed.  */
+  inline const std::vector<std::string> &Get_Parsed_Files(void)
+  {
+    return ParsedFiles;
+  }
+
   /** Get a node with matching ASM name.  ASM names are unique even for C++ so
     * there should not be any clashes.  */
   inline IpaCloneNode *Get_Node(const std::string &name)
@@ -125,6 +131,9 @@ class IpaClones : public Parser
   /** Set of nodes.  */
   std::unordered_map<std::string, IpaCloneNode> Nodes;
 
+  /** Path of the files parsed.  */
+  std::vector<std::string> ParsedFiles;
+
   /** Hold the state machine of the lexer, which is where in the string it is.  */
   class LexingState
   {
@@ -17,6 +17,11 @@
 #include "LLVMMisc.hh"
 #include "NonLLVMMisc.hh"
 
+#include <clang/Lex/Lexer.h>
+
+#include <algorithm>
+#include <climits>
+
 /** Check if Decl is a builtin.  */
 bool Is_Builtin_Decl(const Decl *decl)
 {
@@ -65,6 +70,27 @@ CallGraph *Build_CallGraph_From_AST(ASTUnit *ast)
   return cg;
 }
 
+CallGraphNode *LazyCallGraph::Expand(CallGraphNode *node)
+{
+  if (!Expanded.insert(node).second) {
+    return node;
+  }
+
+  /* Blocks get their edges when the function containing them is added.  */
+  FunctionDecl *func = dyn_cast_or_null<FunctionDecl>(node->getDecl());
+  if (func == nullptr) {
+    return node;
+  }
+
+  /* Adding a single function only looks into its body, and the body of the
+     blocks inside it.  */
+  if (FunctionDecl *definition = func->getDefinition()) {
+    Graph.addToCallGraph(definition);
+  }
+
+  return node;
+}
+
 
 FunctionDecl *Get_Bodyless_Decl(FunctionDecl *decl)
 {
@@ -121,100 +147,190 @@ Decl *Get_Bodyless_Or_Itself(Decl *decl)
   return bodyless ? bodyless : decl;
 }
 
-/* Get the TopLevel Decl that contains the location loc.  */
-Decl *Get_Toplevel_Decl_At_Location(ASTUnit *ast, const SourceLocation &loc)
+const std::vector<IdentifierTokenIndex::IdentifierToken> &
+IdentifierTokenIndex::Get_File_Tokens(FileID file)
 {
-  SourceManager &SM = ast->getSourceManager();
-  /* We don't have a way of accessing the TopLevel vector directly, hence we
-     do this.  */
-  char *p = (char *) &(*ast->top_level_begin());
-  char *q = (char *) &(*ast->top_level_end());
-
-  int n = (((ptrdiff_t)(q - p))/sizeof(Decl *));
-
-  Decl **array = (Decl **)p;
+  auto it = Files.find(file);
+  if (it != Files.end()) {
+    return it->second;
+  }
 
-  /* Do binary search.  */
-  int low = 0;
-  int high = n-1;
-  while (low <= high) {
-    int mid = low + (high - low)/2;
+  std::vector<IdentifierToken> &tokens = Files[file];
 
-    Decl *decl = array[mid];
-    /* Get rid of some weird macro locations.  We want the location where
-       it was expanded.  */
-    SourceRange decl_range(SM.getExpansionLoc(decl->getBeginLoc()),
-                           SM.getExpansionLoc(decl->getEndLoc()));
+  SourceManager &sm = AST->getSourceManager();
+  IdentifierTable &idtbl = AST->getPreprocessor().getIdentifierTable();
+  auto buffer = sm.getBufferOrNone(file);
+  if (!buffer) {
+    return tokens;
+  }
 
-    if (decl_range.fullyContains(loc)) {
-      return decl;
+  Lexer lexer(file, *buffer, sm, AST->getLangOpts());
+  Token tok;
+  while (!lexer.LexFromRawLexer(tok)) {
+    if (!tok.is(tok::raw_identifier)) {
+      continue;
     }
 
-    if (SM.isBeforeInTranslationUnit(decl_range.getBegin(), loc)) {
-      low = mid + 1;
-    } else {
-      high = mid - 1;
+    /* Identifiers which the preprocessor never saw are not interesting, and
+       not adding them keeps the identifier table untouched.  */
+    auto id = idtbl.find(tok.getRawIdentifier());
+    if (id == idtbl.end()) {
+      continue;
     }
+
+    tokens.push_back({sm.getFileOffset(tok.getLocation()), tok.getLength(),
+                      id->getValue()});
   }
 
-  return nullptr;
+  return tokens;
 }
 
-VectorRef<Decl *> Get_Toplev_Decls_With_Same_Beginloc(ASTUnit *ast, const SourceLocation &loc)
+bool IdentifierTokenIndex::Get_Identifiers_In_Range(const SourceRange &range,
+                                                    VectorRef<IdentifierToken> &toks)
 {
-  SourceManager &SM = ast->getSourceManager();
-  /* We don't have a way of accessing the TopLevel vector directly, hence we
-     do this.  */
-  char *p = (char *) &(*ast->top_level_begin());
-  char *q = (char *) &(*ast->top_level_end());
+  toks = VectorRef<IdentifierToken>(nullptr, 0U);
 
-  int n = (((ptrdiff_t)(q - p))/sizeof(Decl *));
+  SourceLocation begin = range.getBegin();
+  SourceLocation end = range.getEnd();
+  if (!begin.isFileID() || !end.isFileID()) {
+    return false;
+  }
+
+  SourceManager &sm = AST->getSourceManager();
+  std::pair<FileID, unsigned> b = sm.getDecomposedLoc(begin);
+  std::pair<FileID, unsigned> e = sm.getDecomposedLoc(end);
+  if (b.first.isInvalid() || b.first != e.first || b.second > e.second) {
+    return false;
+  }
 
-  Decl **array = (Decl **)p;
+  const std::vector<IdentifierToken> &tokens = Get_File_Tokens(b.first);
+  auto cmp = [](const IdentifierToken &tok, unsigned offset) {
+    return tok.Offset < offset;
+  };
+
+  /* The last token of the range begins at its end.  */
+  auto first = std::lower_bound(tokens.begin(), tokens.end(), b.second, cmp);
+  auto last = std::lower_bound(first, tokens.end(), e.second + 1, cmp);
+  if (first != last) {
+    toks = VectorRef<IdentifierToken>(const_cast<IdentifierToken *>(&*first),
+                                      (unsigned)(last - first));
+  }
 
-  /* Do binary search.  */
-  int low = 0;
-  int high = n-1;
-  while (low <= high) {
-    int mid = low + (high - low)/2;
+  return true;
+}
 
-    Decl *decl = array[mid];
+void TopLevelDeclIndex::Build(void)
+{
+  SourceManager &SM = AST->getSourceManager();
+
+  struct Entry
+  {
+    unsigned Begin;
+    unsigned End;
+    Decl *D;
+  };
+  llvm::DenseMap<FileID, std::vector<Entry>> entries;
+
+  for (auto it = AST->top_level_begin(); it != AST->top_level_end(); ++it) {
+    Decl *decl = *it;
     /* Get rid of some weird macro locations.  We want the location where
        it was expanded.  */
-    SourceLocation begin = SM.getExpansionLoc(decl->getBeginLoc());
-
-    if (begin == loc) {
-      /* Go back to the first declaration.  */
-      int last_l = mid;
-      for (int l = mid; l >= 0; --l) {
-        if (SM.getExpansionLoc(array[l]->getBeginLoc()) == loc) {
-          last_l = l;
-        } else {
-          break;
-        }
-      }
+    std::pair<FileID, unsigned> begin = SM.getDecomposedExpansionLoc(decl->getBeginLoc());
+    std::pair<FileID, unsigned> end   = SM.getDecomposedExpansionLoc(decl->getEndLoc());
 
-      /* Go forward to the last declaration.  */
-      int last_h = mid;
-      for (int h = mid; h < n; ++h) {
-        if (SM.getExpansionLoc(array[h]->getBeginLoc()) == loc) {
-          last_h = h;
-        } else {
-          break;
-        }
-      }
+    if (begin.first.isInvalid()) {
+      continue;
+    }
 
-      return VectorRef(&array[last_l], &array[last_h]);
+    /* A decl that ends in another file can only be found by its beginloc.  */
+    unsigned end_offset = (begin.first == end.first) ? end.second : begin.second;
+    entries[begin.first].push_back({begin.second, end_offset, decl});
+  }
+
+  for (auto &pair : entries) {
+    std::vector<Entry> &v = pair.second;
+    /* Toplevel decls are already in order, but be safe.  */
+    std::stable_sort(v.begin(), v.end(), [](const Entry &a, const Entry &b) {
+      return a.Begin < b.Begin;
+    });
+
+    FileDecls &file = Files[pair.first];
+    unsigned max_end = 0;
+    for (const Entry &e : v) {
+      max_end = std::max(max_end, e.End);
+      file.Begin.push_back(e.Begin);
+      file.End.push_back(e.End);
+      file.MaxEnd.push_back(max_end);
+      file.Decls.push_back(e.D);
     }
+  }
 
-    if (SM.isBeforeInTranslationUnit(begin, loc)) {
-      low = mid + 1;
-    } else {
-      high = mid - 1;
+  Built = true;
+}
+
+const TopLevelDeclIndex::FileDecls *
+TopLevelDeclIndex::Lookup(const SourceLocation &loc, unsigned &offset)
+{
+  if (!Built) {
+    Build();
+  }
+
+  std::pair<FileID, unsigned> decomposed =
+    AST->getSourceManager().getDecomposedExpansionLoc(loc);
+
+  auto it = Files.find(decomposed.first);
+  if (it == Files.end()) {
+    return nullptr;
+  }
+
+  offset = decomposed.second;
+  return &it->second;
+}
+
+Decl *TopLevelDeclIndex::Get_Decl_At_Location(const SourceLocation &loc)
+{
+  unsigned offset;
+  const FileDecls *file = Lookup(loc, offset);
+  if (file == nullptr) {
+    return nullptr;
+  }
+
+  /* Find the last decl that begins before or at the location, then walk
+     backwards while some decl may still contain it, picking the innermost
+     one.  Decls only overlap when declared together, e.g. `int a, b;`.  */
+  size_t i = std::upper_bound(file->Begin.begin(), file->Begin.end(), offset)
+             - file->Begin.begin();
+
+  Decl *found = nullptr;
+  unsigned found_size = UINT_MAX;
+  while (i > 0 && file->MaxEnd[i-1] >= offset) {
+    i--;
+    unsigned size = file->End[i] - file->Begin[i];
+    if (file->End[i] >= offset && size < found_size) {
+      found = file->Decls[i];
+      found_size = size;
     }
   }
 
-  return VectorRef<Decl *>(nullptr, 0U);
+  return found;
+}
+
+VectorRef<Decl *> TopLevelDeclIndex::Get_Decls_With_Same_Beginloc(const SourceLocation &loc)
+{
+  unsigned offset;
+  const FileDecls *file = Lookup(loc, offset);
+  if (file == nullptr) {
+    return VectorRef<Decl *>(nullptr, 0U);
+  }
+
+  auto range = std::equal_range(file->Begin.begin(), file->Begin.end(), offset);
+  size_t first = range.first - file->Begin.begin();
+  size_t n = range.second - range.first;
+  if (n == 0) {
+    return VectorRef<Decl *>(nullptr, 0U);
+  }
+
+  return VectorRef<Decl *>(const_cast<Decl **>(&file->Decls[first]), n);
 }
 
 std::string Build_CE_Location_Comment(SourceManager &sm, const SourceLocation &loc)
@@ -21,6 +21,8 @@
 #include "clang/Analysis/CallGraph.h"
 #include "clang/Sema/IdentifierResolver.h"
 #include "clang/AST/DeclContextInternals.h"
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/ADT/DenseSet.h>
 
 #include "NonLLVMMisc.hh"
 
@@ -65,6 +67,36 @@ bool Is_Builtin_Decl(const Decl *decl);
  */
 CallGraph *Build_CallGraph_From_AST(ASTUnit *ast);
 
+/** @brief CallGraph built on demand.
+ *
+ * Build_CallGraph_From_AST looks into the body of every function in the AST,
+ * including every inline function in the headers, even if only the functions
+ * reachable from a few of them are of interest.  This class only creates the
+ * nodes of the functions which are asked for, and only looks into the body of
+ * a function when the edges to its callees are asked for by Expand.  The cost
+ * is then proportional to the part of the graph which is actually walked.
+ */
+class LazyCallGraph
+{
+  public:
+  /** Get the node of decl, creating it if needed.  Its callees are not
+      computed.  */
+  inline CallGraphNode *Get_Node(FunctionDecl *decl)
+  {
+    return Graph.getOrInsertNode(decl);
+  }
+
+  /** Compute the edges from node to its callees, if not done yet, and return
+      node.  Nodes are created for the callees but they are not expanded.  */
+  CallGraphNode *Expand(CallGraphNode *node);
+
+  private:
+  CallGraph Graph;
+
+  /* Nodes which edges were already computed.  */
+  llvm::DenseSet<const CallGraphNode *> Expanded;
+};
+
 /* Look into previous versions of `decl` for a declaration in the AST without
    a body.  */
 FunctionDecl *Get_Bodyless_Decl(FunctionDecl *decl);
@@ -77,11 +109,90 @@ FunctionDecl *Get_Bodyless_Or_Itself(FunctionDecl *decl);
 TagDecl      *Get_Bodyless_Or_Itself(TagDecl *decl);
 Decl         *Get_Bodyless_Or_Itself(Decl *decl);
 
-/* Get the TopLevel Decl that contains the location loc.  */
-Decl *Get_Toplevel_Decl_At_Location(ASTUnit *ast, const SourceLocation &loc);
+/** Index of the toplevel decls of an AST by the location where they were
+    expanded.
+ *
+ * The decls are grouped by FileID and sorted by the offset of their begin
+ * location, so queries are binary searches over integers instead of asking
+ * the SourceManager to compare locations on every probe.  The index is built
+ * on the first query.
+ */
+class TopLevelDeclIndex
+{
+  public:
+  TopLevelDeclIndex(ASTUnit *ast)
+    : AST(ast),
+      Built(false)
+  {
+  }
+
+  /** Get the TopLevel Decl that contains the location loc.  */
+  Decl *Get_Decl_At_Location(const SourceLocation &loc);
+
+  /** Get Toplevel decls with same beginloc as the expansion of loc.  */
+  VectorRef<Decl *> Get_Decls_With_Same_Beginloc(const SourceLocation &loc);
 
-/* Get Toplevel decls with same beginloc.  */
-VectorRef<Decl *> Get_Toplev_Decls_With_Same_Beginloc(ASTUnit *ast, const SourceLocation &loc);
+  private:
+  /** The decls that begin in a single file, sorted by the begin offset.  */
+  struct FileDecls
+  {
+    std::vector<unsigned> Begin;
+    std::vector<unsigned> End;
+    /* Largest end offset of decls [0, i], used to stop searching backwards.  */
+    std::vector<unsigned> MaxEnd;
+    std::vector<Decl *> Decls;
+  };
+
+  void Build(void);
+
+  /** Find the decls of the file where loc was expanded and its offset.  */
+  const FileDecls *Lookup(const SourceLocation &loc, unsigned &offset);
+
+  ASTUnit *AST;
+
+  bool Built;
+
+  llvm::DenseMap<FileID, FileDecls> Files;
+};
+
+/** @brief Index of the identifiers of each file.
+ *
+ * Looking for identifiers in a source range by tokenizing its text is
+ * expensive when done for many ranges of the same file, as every decl and
+ * macro expansion does.  This class runs the raw lexer on each file only once,
+ * the first time a range in it is asked for, and answers by binary searching
+ * the offsets of the tokens.
+ */
+class IdentifierTokenIndex
+{
+  public:
+  IdentifierTokenIndex(ASTUnit *ast)
+    : AST(ast)
+  {
+  }
+
+  struct IdentifierToken
+  {
+    unsigned Offset;
+    unsigned Length;
+    IdentifierInfo *Info;
+  };
+
+  /** Get the identifier tokens in range, in order, into toks.  As in clang's
+      SourceRange the end of range is the location of its last token.  Returns
+      false if the index can't answer, which is when the ends of range are not
+      file locations in the same file in order.  */
+  bool Get_Identifiers_In_Range(const SourceRange &range,
+                                VectorRef<IdentifierToken> &toks);
+
+  private:
+  /** Lex the file and index its identifiers.  */
+  const std::vector<IdentifierToken> &Get_File_Tokens(FileID file);
+
+  ASTUnit *AST;
+
+  llvm::DenseMap<FileID, std::vector<IdentifierToken>> Files;
+};
 
 /** Build a clang-extract location comment.  */
 std::string Build_CE_Location_Comment(SourceManager &sm, const SourceLocation &loc);
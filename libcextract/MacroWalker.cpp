@@ -16,50 +16,109 @@
 #include "MacroWalker.hh"
 #include "PrettyPrint.hh"
 
-MacroInfo *MacroWalker::Get_Macro_Info(MacroDefinitionRecord *record)
+#include <algorithm>
+
+std::shared_ptr<MacroHistoryIndex> MacroHistoryIndex::Get(Preprocessor &pp)
 {
-  MacroDirective *directive = Get_Macro_Directive(record);
-  return directive ? directive->getMacroInfo() : nullptr;
+  std::shared_ptr<MacroHistoryIndex> &index = PrettyPrint::Ctx().MacroIndex;
+  if (index == nullptr || &index->PP != &pp) {
+    index = std::make_shared<MacroHistoryIndex>(pp);
+  }
+  return index;
 }
 
-MacroInfo *MacroWalker::Get_Macro_Info(MacroExpansion *macroexp)
+void MacroHistoryIndex::Clear(void)
 {
-  SourceLocation loc = macroexp->getSourceRange().getBegin();
-  const IdentifierInfo *id = macroexp->getName();
-  return Get_Macro_Info(id, loc);
+  PrettyPrint::Ctx().MacroIndex = nullptr;
 }
 
-MacroInfo *MacroWalker::Get_Macro_Info(const IdentifierInfo *id, const SourceLocation &loc)
+MacroHistoryIndex::History &MacroHistoryIndex::Get_History(const IdentifierInfo *id)
 {
-  MacroDirective *directive = PProcessor.getLocalMacroDirectiveHistory(id);
-  while (directive) {
+  auto it = Histories.find(id);
+  if (it != Histories.end()) {
+    return it->second;
+  }
+
+  History &history = Histories[id];
+
+  /* The history goes from the last directive to the first.  An #undef refers
+     to the MacroInfo of the definition it undefines, so skip repeated
+     MacroInfos.  */
+  MacroDirective *directive = PP.getLocalMacroDirectiveHistory(id);
+  for (; directive; directive = directive->getPrevious()) {
     MacroInfo *macroinfo = directive->getMacroInfo();
+    if (macroinfo == nullptr) {
+      continue;
+    }
 
-    if (!macroinfo->getDefinitionLoc().isValid()) {
-      /* Skip if macro expansion seems to not have a valid location.  */
-      directive = directive->getPrevious();
+    SourceLocation loc = macroinfo->getDefinitionLoc();
+    if (!loc.isValid()) {
       continue;
     }
 
-    /* If this MacroInfo object location is defined AFTER the given loc, then
-       it means we are looking for a macro that was later redefined.  So we
-       look into the previous definitions to find the last one that is defined
-       before loc.  */
+    DirectiveAt.try_emplace(loc, directive);
+    if (history.Defs.empty() || history.Defs.back().second != macroinfo) {
+      history.Defs.push_back({ loc, macroinfo });
+    }
+  }
 
-    if (PrettyPrint::Is_Before(macroinfo->getDefinitionLoc(), loc))
-      return macroinfo;
+  std::reverse(history.Defs.begin(), history.Defs.end());
 
-    directive = directive->getPrevious();
+  history.Sorted = true;
+  for (size_t i = 1; i < history.Defs.size(); i++) {
+    if (!PrettyPrint::Is_Before(history.Defs[i-1].first, history.Defs[i].first)) {
+      history.Sorted = false;
+      break;
+    }
+  }
+
+  return history;
+}
+
+MacroInfo *MacroHistoryIndex::Get_Macro_Info(const IdentifierInfo *id,
+                                             const SourceLocation &loc)
+{
+  History &history = Get_History(id);
+  auto &defs = history.Defs;
+
+  /* We are looking for the last definition before loc, as the macro may have
+     been redefined later.  */
+  if (history.Sorted) {
+    auto it = std::partition_point(defs.begin(), defs.end(),
+                  [&](const std::pair<SourceLocation, MacroInfo *> &def) {
+                    return PrettyPrint::Is_Before(def.first, loc);
+                  });
+    return (it == defs.begin()) ? nullptr : std::prev(it)->second;
+  }
+
+  for (auto it = defs.rbegin(); it != defs.rend(); ++it) {
+    if (PrettyPrint::Is_Before(it->first, loc)) {
+      return it->second;
+    }
   }
 
   /* MacroInfo object not found.  */
   return nullptr;
 }
 
-MacroDirective *MacroWalker::Get_Macro_Directive(MacroDefinitionRecord *record)
+MacroDirective *MacroHistoryIndex::Get_Macro_Directive(MacroDefinitionRecord *record)
 {
   const IdentifierInfo *id = record->getName();
-  MacroDirective *directive = PProcessor.getLocalMacroDirectiveHistory(id);
+  Get_History(id);
+
+  /* The record is usually at the definition location of its MacroInfo.  */
+  auto it = DirectiveAt.find(record->getLocation());
+  if (it != DirectiveAt.end()) {
+    MacroInfo *macroinfo = it->second->getMacroInfo();
+    SourceRange range1(macroinfo->getDefinitionLoc(), macroinfo->getDefinitionEndLoc());
+    SourceRange range2(record->getLocation());
+    if (range1.fullyContains(range2)) {
+      return it->second;
+    }
+  }
+
+  /* Otherwise walk the history looking for the definition containing it.  */
+  MacroDirective *directive = PP.getLocalMacroDirectiveHistory(id);
   while (directive) {
     MacroInfo *macroinfo = directive->getMacroInfo();
 
@@ -76,6 +135,29 @@ MacroDirective *MacroWalker::Get_Macro_Directive(MacroDefinitionRecord *record)
   return nullptr;
 }
 
+MacroInfo *MacroWalker::Get_Macro_Info(MacroDefinitionRecord *record)
+{
+  MacroDirective *directive = Get_Macro_Directive(record);
+  return directive ? directive->getMacroInfo() : nullptr;
+}
+
+MacroInfo *MacroWalker::Get_Macro_Info(MacroExpansion *macroexp)
+{
+  SourceLocation loc = macroexp->getSourceRange().getBegin();
+  const IdentifierInfo *id = macroexp->getName();
+  return Get_Macro_Info(id, loc);
+}
+
+MacroInfo *MacroWalker::Get_Macro_Info(const IdentifierInfo *id, const SourceLocation &loc)
+{
+  return Index->Get_Macro_Info(id, loc);
+}
+
+MacroDirective *MacroWalker::Get_Macro_Directive(MacroDefinitionRecord *record)
+{
+  return Index->Get_Macro_Directive(record);
+}
+
 bool MacroWalker::Is_Builtin_Macro(MacroInfo *info)
 {
   if (info->isBuiltinMacro())
@@ -16,14 +16,70 @@
 #pragma once
 
 #include <clang/Tooling/Tooling.h>
+#include <llvm/ADT/DenseMap.h>
+
+#include <memory>
+#include <vector>
 
 using namespace clang;
 
+/** @brief Index of the macro definition history of a Preprocessor.
+ *
+ * Macros can be redefined, so finding which definition of a macro is active
+ * at a location requires walking its history.  This index is built lazily
+ * for each identifier and turns this into a binary search.  As MacroWalkers
+ * are created everywhere, the index is shared among all of them.
+ */
+class MacroHistoryIndex
+{
+  public:
+  MacroHistoryIndex(Preprocessor &pp)
+    : PP(pp)
+  {
+  }
+
+  /** Get the index of the given Preprocessor, building a new one if the last
+      one built in the current PrettyPrint context was for another
+      Preprocessor.  */
+  static std::shared_ptr<MacroHistoryIndex> Get(Preprocessor &pp);
+
+  /** Discard the index of the current PrettyPrint context.  Must be called
+      when the AST changes.  */
+  static void Clear(void);
+
+  /** Get the last definition of id before loc.  */
+  MacroInfo *Get_Macro_Info(const IdentifierInfo *id, const SourceLocation &loc);
+
+  /** Get the directive which defined record.  */
+  MacroDirective *Get_Macro_Directive(MacroDefinitionRecord *record);
+
+  private:
+  struct History
+  {
+    /* Definitions with valid locations, from the first to the last.  */
+    std::vector<std::pair<SourceLocation, MacroInfo *>> Defs;
+
+    /* If the locations in Defs are sorted, which allows a binary search.  */
+    bool Sorted;
+  };
+
+  History &Get_History(const IdentifierInfo *id);
+
+  Preprocessor &PP;
+
+  llvm::DenseMap<const IdentifierInfo *, History> Histories;
+
+  /* Maps the definition location of a MacroInfo to the last directive in the
+     history which refers to it.  */
+  llvm::DenseMap<SourceLocation, MacroDirective *> DirectiveAt;
+};
+
 class MacroWalker
 {
   public:
   MacroWalker(Preprocessor &p)
-    : PProcessor(p)
+    : PProcessor(p),
+      Index(MacroHistoryIndex::Get(p))
   {
   }
 
@@ -45,4 +101,6 @@ class MacroWalker
 
   private:
   Preprocessor &PProcessor;
+
+  std::shared_ptr<MacroHistoryIndex> Index;
 };
@@ -0,0 +1,136 @@
+//===- OutputBuffer.cpp - In-memory output of the printer ------ *- C++ -*-===//
+//
+// This project is licensed under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+/// \file
+/// In-memory output of the printer, which can be handed to the filesystem
+/// without copying.
+//
+//===----------------------------------------------------------------------===//
+
+/* Author: Giuliano Belinassi  */
+
+#include "OutputBuffer.hh"
+
+#include <algorithm>
+#include <cstring>
+
+/** MemoryBuffer which keeps an arena alive instead of owning a copy.  */
+class OutputBuffer::ArenaMemoryBuffer : public MemoryBuffer
+{
+  public:
+  ArenaMemoryBuffer(std::shared_ptr<Arena> arena, StringRef name)
+    : Storage(arena),
+      Name(name.str())
+  {
+    /* The arena is never written again once shared, so the terminator
+       stays in place.  */
+    const char *data = Storage->Data.get();
+    init(data, data + Storage->Size, /*RequiresNullTerminator=*/true);
+  }
+
+  StringRef getBufferIdentifier(void) const override
+  {
+    return Name;
+  }
+
+  BufferKind getBufferKind(void) const override
+  {
+    return MemoryBuffer_Malloc;
+  }
+
+  private:
+  std::shared_ptr<Arena> Storage;
+  std::string Name;
+};
+
+OutputBuffer::OutputBuffer(size_t reserve)
+  : raw_ostream(/*unbuffered=*/true),
+    Reserved(std::max<size_t>(reserve, 1)),
+    Storage(std::make_shared<Arena>(Reserved))
+{
+}
+
+OutputBuffer::~OutputBuffer(void)
+{
+}
+
+StringRef OutputBuffer::Get_Text(void)
+{
+  return StringRef(Storage->Data.get(), Storage->Size);
+}
+
+std::unique_ptr<MemoryBuffer> OutputBuffer::Get_MemoryBuffer(StringRef name)
+{
+  return std::make_unique<ArenaMemoryBuffer>(Storage, name);
+}
+
+bool OutputBuffer::Write_To_File(const std::string &path)
+{
+  std::error_code ec;
+  raw_fd_ostream out(path, ec);
+  if (ec) {
+    return false;
+  }
+
+  /* Do not split the text through the stream buffer.  */
+  out.SetUnbuffered();
+  out.write(Storage->Data.get(), Storage->Size);
+  out.close();
+
+  if (out.has_error()) {
+    out.clear_error();
+    return false;
+  }
+  return true;
+}
+
+void OutputBuffer::Clear(void)
+{
+  if (Storage.use_count() > 1) {
+    /* Someone still holds the text.  Leave it to them.  */
+    Storage = std::make_shared<Arena>(Reserved);
+  } else {
+    Storage->Size = 0;
+    Storage->Data[0] = '\0';
+  }
+}
+
+void OutputBuffer::Reserve(size_t size)
+{
+  size_t needed = Storage->Size + size + 1;
+  bool shared = Storage.use_count() > 1;
+
+  if (!shared && needed <= Storage->Capacity) {
+    return;
+  }
+
+  size_t capacity = Storage->Capacity;
+  while (capacity < needed) {
+    capacity *= 2;
+  }
+
+  std::shared_ptr<Arena> arena = std::make_shared<Arena>(capacity);
+  memcpy(arena->Data.get(), Storage->Data.get(), Storage->Size);
+  arena->Size = Storage->Size;
+  Storage = arena;
+}
+
+void OutputBuffer::write_impl(const char *ptr, size_t size)
+{
+  Reserve(size);
+
+  Arena &arena = *Storage;
+  memcpy(arena.Data.get() + arena.Size, ptr, size);
+  arena.Size += size;
+  arena.Data[arena.Size] = '\0';
+}
+
+uint64_t OutputBuffer::current_pos(void) const
+{
+  return Storage->Size;
+}
@@ -0,0 +1,91 @@
+//===- OutputBuffer.hh - In-memory output of the printer ------- *- C++ -*-===//
+//
+// This project is licensed under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+/// \file
+/// In-memory output of the printer, which can be handed to the filesystem
+/// without copying.
+//
+//===----------------------------------------------------------------------===//
+
+/* Author: Giuliano Belinassi  */
+
+#pragma once
+
+#include <llvm/Support/raw_ostream.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <memory>
+#include <string>
+
+using namespace llvm;
+
+/** @brief Stream which accumulates the printed code into an arena.
+ *
+ * The generated code goes through the in-memory filesystem before being
+ * parsed again, and is eventually written to disk.  Printing into a
+ * std::string means copying it for each of those steps.  This buffer instead
+ * reserves a large arena upfront and hands out MemoryBuffers which share it,
+ * so the filesystem and the AST built from it refer to the printed text
+ * itself.
+ *
+ * An arena shared with a MemoryBuffer is never modified again: writing after
+ * Get_MemoryBuffer moves the text into a new arena first.
+ */
+class OutputBuffer : public raw_ostream
+{
+  public:
+  OutputBuffer(size_t reserve = DefaultReserve);
+
+  ~OutputBuffer(void) override;
+
+  /** The text written so far.  */
+  StringRef Get_Text(void);
+
+  /** Get a null-terminated MemoryBuffer named `name` with the text written so
+      far.  It shares the storage with this object.  */
+  std::unique_ptr<MemoryBuffer> Get_MemoryBuffer(StringRef name);
+
+  /** Write the text into the file at path with a single write.  Returns false
+      if that is not possible.  */
+  bool Write_To_File(const std::string &path);
+
+  /** Discard the text.  MemoryBuffers given before remain valid.  */
+  void Clear(void);
+
+  /** Default size of the arena.  */
+  static constexpr size_t DefaultReserve = 1 << 20;
+
+  private:
+  struct Arena
+  {
+    Arena(size_t capacity)
+      : Data(new char[capacity]),
+        Size(0),
+        Capacity(capacity)
+    {
+      Data[0] = '\0';
+    }
+
+    std::unique_ptr<char[]> Data;
+    size_t Size;
+    size_t Capacity;
+  };
+
+  class ArenaMemoryBuffer;
+
+  void write_impl(const char *ptr, size_t size) override;
+
+  uint64_t current_pos(void) const override;
+
+  /* Make sure there is space for size more bytes and the null terminator in
+     an arena which is not shared.  */
+  void Reserve(size_t size);
+
+  size_t Reserved;
+
+  std::shared_ptr<Arena> Storage;
+};
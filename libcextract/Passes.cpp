@@ -25,12 +25,15 @@
 #include "DscFileGenerator.hh"
 #include "NonLLVMMisc.hh"
 #include "Error.hh"
+#include "InputManifest.hh"
 #include "HeaderGenerate.hh"
 #include "LLVMMisc.hh"
 
 #include "clang/Frontend/ASTUnit.h"
 #include "clang/Frontend/CompilerInstance.h"
 
+#include <llvm/Support/FileSystem.h>
+
 #include <iostream>
 
 using namespace llvm;
@@ -127,6 +130,88 @@ static std::string Get_Output_Path(PassManager::Context *ctx)
   return output_path;
 }
 
+/* Escape path so that make and ninja read it as a single file name.  */
+static std::string Escape_Dependency_Path(const std::string &path)
+{
+  std::string escaped;
+  for (char c : path) {
+    if (c == ' ' || c == '#' || c == ':' || c == '\\') {
+      escaped += '\\';
+    } else if (c == '$') {
+      escaped += '$';
+    }
+    escaped += c;
+  }
+
+  return escaped;
+}
+
+/** Get the files the output depends on: the main file, the headers which
+    contributed to it, the analysis databases read and the expansion rules.  */
+static std::vector<std::string> Get_Dependency_List(PassManager::Context *ctx)
+{
+  std::vector<std::string> deps;
+  deps.push_back(ctx->InputPath);
+  for (const std::string &dep : ctx->Dependencies) {
+    if (dep != ctx->InputPath) {
+      deps.push_back(dep);
+    }
+  }
+  for (const std::string &file : ctx->IA.Get_Input_Files()) {
+    deps.push_back(file);
+  }
+  if (ctx->ExpansionPolicyFile) {
+    deps.push_back(ctx->ExpansionPolicyFile);
+  }
+
+  return deps;
+}
+
+/** Get the files the manifest records: every file entered when parsing the
+    input, even if it contributed nothing to the output, as it could once it
+    changes.  Plus the analysis databases read and the expansion rules.  */
+static std::vector<std::string> Get_Manifest_File_List(PassManager::Context *ctx)
+{
+  std::vector<std::string> files;
+  files.push_back(ctx->InputPath);
+  for (const std::string &file : ctx->InputFiles) {
+    if (file != ctx->InputPath) {
+      files.push_back(file);
+    }
+  }
+  for (const std::string &file : ctx->IA.Get_Input_Files()) {
+    files.push_back(file);
+  }
+  if (ctx->ExpansionPolicyFile) {
+    files.push_back(ctx->ExpansionPolicyFile);
+  }
+
+  return files;
+}
+
+/** Write the Makefile dependency file of the output.  */
+static bool Write_Dependency_File(PassManager::Context *ctx)
+{
+  std::error_code ec;
+  llvm::raw_fd_ostream out(ctx->DependencyFile, ec);
+  if (ec) {
+    return false;
+  }
+
+  out << Escape_Dependency_Path(Get_Output_Path(ctx)) << ':';
+  for (const std::string &dep : Get_Dependency_List(ctx)) {
+    out << " \\\n  " << Escape_Dependency_Path(dep);
+  }
+  out << '\n';
+
+  out.close();
+  if (out.has_error()) {
+    out.clear_error();
+    return false;
+  }
+  return true;
+}
+
 /** BuildASTPass: Built the AST object and store it into the Context object.
  *
  * This may be the first pass of the pass queue, as the AST object is used by
@@ -179,6 +264,10 @@ class BuildASTPass : public Pass
     /* Get the input file path.  */
     ctx->InputPath = Get_Input_File(ctx->AST.get()).str();
 
+    if (ctx->RecordInputFiles) {
+      Record_Input_Files(ctx);
+    }
+
     const DiagnosticsEngine &de = ctx->AST->getDiagnostics();
     return !de.hasErrorOccurred();
   }
@@ -201,6 +290,25 @@ class BuildASTPass : public Pass
     out.close();
   }
 
+  /** Record every file #include'd when parsing the input.  The
+      PreprocessingRecord also holds the #includes in the preamble, and the
+      ones the multiple include optimization skipped.  */
+  void Record_Input_Files(PassManager::Context *ctx)
+  {
+    PreprocessingRecord *rec = ctx->AST->getPreprocessor().getPreprocessingRecord();
+    if (rec == nullptr) {
+      return;
+    }
+
+    for (PreprocessedEntity *entity : *rec) {
+      if (InclusionDirective *id = dyn_cast<InclusionDirective>(entity)) {
+        if (OptionalFileEntryRef file = id->getFile()) {
+          ctx->InputFiles.insert(file->getName().str());
+        }
+      }
+    }
+  }
+
   StringRef Get_Input_File(ASTUnit *ast)
   {
     SourceManager &sm = ast->getSourceManager();
@@ -301,20 +409,23 @@ class ClosurePass : public Pass
 
     virtual bool Run_Pass(PassManager::Context *ctx)
     {
-      ctx->CodeOutput = std::string();
-      raw_string_ostream code_stream(ctx->CodeOutput);
-
-      PrettyPrint::Set_Output_Ostream(&code_stream);
+      ctx->CodeOutput.Clear();
+      PrettyPrint::Set_Output_Ostream(&ctx->CodeOutput);
 
       /* Compute closure and output the code.  */
       FunctionDependencyFinder fdf(ctx);
       if (fdf.Run_Analysis(ctx->FuncExtractNames) == false) {
         return false;
       }
+      if (ctx->CollectDependencies) {
+        fdf.Collect_Dependencies(ctx->Dependencies);
+      }
       fdf.Print();
 
-      /* Add the temporary string with code to the filesystem.  */
-      ctx->MFS->addFile(ctx->InputPath, 0, MemoryBuffer::getMemBufferCopy(ctx->CodeOutput));
+      /* Add the temporary code to the filesystem.  The buffer shares the
+         printed text, so this does not copy it.  */
+      ctx->MFS->addFile(ctx->InputPath, 0,
+                        ctx->CodeOutput.Get_MemoryBuffer(ctx->InputPath));
 
       //Print_AST(ctx->AST.get());
 
@@ -340,24 +451,29 @@ class ClosurePass : public Pass
         return false;
       }
 
-      /* Set output stream to a file if we set to print to a file.  */
+      /* If we print to a file, the code is written once all passes are done,
+         as some of them append to it.  */
       if (PrintToFile) {
-        std::string output_path = Get_Output_Path(ctx);
-        PrettyPrint::Set_Output_To(output_path);
-      } else {
-        ctx->CodeOutput = std::string();
-        PrettyPrint::Set_Output_Ostream(&code_stream);
+        ctx->FinalOutputPath = Get_Output_Path(ctx);
       }
+      ctx->CodeOutput.Clear();
+      PrettyPrint::Set_Output_Ostream(&ctx->CodeOutput);
 
       /* Compute closure and output the code.  */
       FunctionDependencyFinder fdf2(ctx);
       if (fdf2.Run_Analysis(ctx->FuncExtractNames) == false) {
         return false;
       }
+      if (ctx->CollectDependencies) {
+        fdf2.Collect_Dependencies(ctx->Dependencies);
+      }
       fdf2.Print();
 
-      /* Add the temporary string with code to the filesystem.  */
-      ctx->MFS->addFile(ctx->InputPath, 0, MemoryBuffer::getMemBufferCopy(ctx->CodeOutput));
+      /* Add the temporary code to the filesystem.  */
+      if (!PrintToFile) {
+        ctx->MFS->addFile(ctx->InputPath, 0,
+                          ctx->CodeOutput.Get_MemoryBuffer(ctx->InputPath));
+      }
 
       const DiagnosticsEngine &de2 = ctx->AST->getDiagnostics();
       return !de2.hasErrorOccurred();
@@ -367,7 +483,7 @@ class ClosurePass : public Pass
     {
       std::error_code ec;
       llvm::raw_fd_ostream out(Get_Dump_Name_From_Input(ctx), ec);
-      out << ctx->CodeOutput;
+      out << ctx->CodeOutput.Get_Text();
       out.close();
     }
 
@@ -458,7 +574,8 @@ class FunctionExternalizerPass : public Pass
 
       if (ctx->DumpPasses) {
         /* Something for the poor debugging user.  */
-        ctx->CodeOutput = externalizer.Get_Modifications_To_Main_File();
+        ctx->CodeOutput.Clear();
+        ctx->CodeOutput << externalizer.Get_Modifications_To_Main_File();
       }
 
       /* Parse the temporary code to apply the changes by the externalizer
@@ -488,7 +605,7 @@ class FunctionExternalizerPass : public Pass
       out << "*/\n";
 
       /* Then the code.  */
-      out << ctx->CodeOutput;
+      out << ctx->CodeOutput.Get_Text();
     }
 };
 
@@ -589,6 +706,12 @@ public:
   }
 };
 
+/** HeaderGenerationPass: Print the prototypes of the externalized functions
+ *                        into the header requested by the user.
+ *
+ * Runs last, so the prototypes are printed after IbtTailGeneratePass dropped
+ * the attributes of the decls it references.
+ */
 class HeaderGenerationPass : public Pass
 {
   public:
@@ -607,12 +730,17 @@ class HeaderGenerationPass : public Pass
   {
     std::error_code ec;
     llvm::raw_fd_ostream out(ctx->OutputFunctionPrototypeHeader, ec);
+    if (ec) {
+      DiagsClass::Emit_Error("Unable to write header to " +
+                             std::string(ctx->OutputFunctionPrototypeHeader));
+      return false;
+    }
     PrettyPrint::Set_Output_Ostream(&out);
 
     HeaderGeneration HGen(ctx);
     HGen.Print();
 
-    PrettyPrint::Set_Output_Ostream(nullptr);
+    PrettyPrint::Set_Output_Ostream(&ctx->CodeOutput);
     return true;
   }
 
@@ -648,6 +776,51 @@ PassManager::~PassManager()
 
 int PassManager::Run_Passes(ArgvParser &args)
 {
+  int ret = 0;
+
+  /* State of PrettyPrint and diagnostics engine for this run, so that runs in
+     other threads do not interfere with this one.  Install them before
+     building the context, as it already loads the analysis databases and the
+     expansion rules, which may report errors.  */
+  PrettyPrintContext print_context;
+  DiagsClass diags;
+  PrettyPrintContext::Scope print_scope(&print_context);
+  DiagsClass::Scope diags_scope(&diags);
+
+  /* Check if the last successful run had the same inputs before building the
+     context, as it already reads the analysis databases.  */
+  std::string manifest_path;
+  uint64_t args_hash = 0;
+  if (args.Should_Skip_Unchanged()) {
+    if (args.Get_Output_File().empty()) {
+      DiagsClass::Emit_Warn("-DCE_SKIP_UNCHANGED requires -DCE_OUTPUT_FILE.  Ignoring it.");
+    } else {
+      std::vector<std::string> products = { args.Get_Output_File() };
+      if (args.Get_Dependency_File()) {
+        products.push_back(args.Get_Dependency_File());
+      }
+      if (!is_null_or_empty(args.Get_Dsc_Output_Path())) {
+        products.push_back(args.Get_Dsc_Output_Path());
+      }
+      if (!is_null_or_empty(args.Get_Output_Path_To_Prototype_Header())) {
+        products.push_back(args.Get_Output_Path_To_Prototype_Header());
+      }
+
+      manifest_path = InputManifest::Get_Path(args.Get_Output_File());
+      args_hash = InputManifest::Hash_Command_Line(args.Get_Normalized_Command_Line());
+      if (InputManifest::Is_Up_To_Date(manifest_path, args_hash, products)) {
+        return 0;
+      }
+
+      /* The output is about to change.  */
+      InputManifest::Remove(manifest_path);
+    }
+  }
+
+  /* Where the output goes.  A failed run must not leave the output of a
+     previous run there.  */
+  std::string output_path = args.Get_Output_File();
+
   /* Build context object to avoid using global variables.  */
   try {
     Context ctx(args);
@@ -664,14 +837,48 @@ int PassManager::Run_Passes(ArgvParser &args)
 
         if (pass_success == false) {
           std::cerr << '\n' << "Error on pass: " << pass->PassName << '\n';
-          return -1;
+          ret = -1;
+          break;
         }
       }
     }
+
+    /* Without -DCE_OUTPUT_FILE, the output is named after the input.  */
+    if (!ctx.InputPath.empty()) {
+      output_path = Get_Output_Path(&ctx);
+    }
+
+    /* Write the final output at once, and only if every pass succeeded.  */
+    if (ret == 0 && !ctx.FinalOutputPath.empty() &&
+        !ctx.CodeOutput.Write_To_File(ctx.FinalOutputPath)) {
+      DiagsClass::Emit_Error("Unable to write output to " + ctx.FinalOutputPath);
+      ret = -1;
+    }
+
+    if (ret == 0 && ctx.DependencyFile && !Write_Dependency_File(&ctx)) {
+      DiagsClass::Emit_Error("Unable to write dependency file " +
+                             std::string(ctx.DependencyFile));
+      ret = -1;
+    }
+
+    /* Not being able to write the manifest only means the next run will not
+       be skipped.  */
+    if (ret == 0 && !manifest_path.empty() &&
+        !InputManifest::Write(manifest_path, args_hash, Get_Manifest_File_List(&ctx))) {
+      DiagsClass::Emit_Warn("Unable to write manifest " + manifest_path);
+    }
+
+    if (ctx.DumpPasses) {
+      PrettyPrint::Dump_Cache_Stats(llvm::errs());
+    }
   } catch (std::runtime_error &err) {
     DiagsClass::Emit_Error(err.what());
-    return -1;
+    ret = -1;
+  }
+
+  if (ret != 0 && !output_path.empty()) {
+    sys::fs::remove(output_path);
   }
 
-  return 0;
+  return ret;
 }
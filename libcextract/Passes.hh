@@ -19,6 +19,7 @@
 #include "InlineAnalysis.hh"
 #include "SymbolExternalizer.hh"
 #include "ExpansionPolicy.hh"
+#include "OutputBuffer.hh"
 #include "clang/Frontend/ASTUnit.h"
 
 using namespace clang;
@@ -65,6 +66,14 @@ class PassManager {
             OutputFunctionPrototypeHeader(args.Get_Output_Path_To_Prototype_Header()),
             IncExpansionPolicy(IncludeExpansionPolicy::Get_Overriding(
                                args.Get_Include_Expansion_Policy(), Kernel)),
+            ExpansionPolicy(IncludeExpansionPolicy::Get_Expansion_Policy_Shared(
+                            IncExpansionPolicy, args.Get_Expansion_Policy_File())),
+            Jobs(args.Get_Jobs()),
+            MinimizeOutput(args.Should_Minimize_Output()),
+            DependencyFile(args.Get_Dependency_File()),
+            ExpansionPolicyFile(args.Get_Expansion_Policy_File()),
+            CollectDependencies(DependencyFile != nullptr),
+            RecordInputFiles(args.Should_Skip_Unchanged()),
             NamesLog(),
             PassNum(0),
             IA(DebuginfoPath, IpaclonesPath, SymversPath, args.Is_Kernel())
@@ -138,6 +147,35 @@ class PassManager {
         /* Policy used to expand includes.  */
         IncludeExpansionPolicy::Policy IncExpansionPolicy;
 
+        /* The policy object, built once and shared by every IncludeTree.  */
+        std::shared_ptr<IncludeExpansionPolicy> ExpansionPolicy;
+
+        /* Number of threads used to compute the closure.  */
+        unsigned Jobs;
+
+        /* Output only forward declarations of records used through pointers.  */
+        bool MinimizeOutput;
+
+        /* Path to the Makefile dependency file to write, if any.  */
+        const char *DependencyFile;
+
+        /* File with user rules for include expansion, if any.  */
+        const char *ExpansionPolicyFile;
+
+        /* Should the files the output depends on be collected?  */
+        bool CollectDependencies;
+
+        /** Source files which contributed to the output.  Only collected if
+            CollectDependencies is set.  */
+        std::set<std::string> Dependencies;
+
+        /* Should the files entered when parsing the input be recorded?  */
+        bool RecordInputFiles;
+
+        /** Every file the preprocessor entered when parsing the input, as
+            listed by -MD.  Only recorded if RecordInputFiles is set.  */
+        std::set<std::string> InputFiles;
+
         /** Log of changed names.  */
         std::vector<ExternalizerLogEntry> NamesLog;
 
@@ -148,7 +186,10 @@ class PassManager {
         std::string InputPath;
 
         /** Generated code by the pass.  */
-        std::string CodeOutput;
+        OutputBuffer CodeOutput;
+
+        /** Where CodeOutput goes once all passes are done, if anywhere.  */
+        std::string FinalOutputPath;
 
         /* InlineAnalysis object that will persists through the entire analysis.
            Avoid rebuilding it as it may require parsing several very large
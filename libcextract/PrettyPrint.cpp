@@ -23,7 +23,7 @@
 
 /** Public methods.  */
 
-#define Out (*Out)
+#define Out (*Ctx().Out)
 
 void PrettyPrint::Print_Decl(Decl *decl)
 {
@@ -39,7 +39,7 @@ void PrettyPrint::Print_Decl(Decl *decl)
     Print_Decl_Raw(f);
     Out << "\n\n";
   } else if (e) {
-      decl->print(Out, PPolicy);
+      decl->print(Out, Ctx().PPolicy);
       Out << ";\n\n";
   } else if (!e && t && t->getName() == "") {
     /* If the RecordType doesn't have a name, then don't print it.  Except when
@@ -153,10 +153,10 @@ void PrettyPrint::Print_Decl_Raw(Decl *decl)
         TagDecl *tagdecl = typedecl->getAnonDeclWithTypedefName();
         if (tagdecl && tagdecl->getName() == "") {
           Out << "typedef ";
-          tagdecl->getDefinition()->print(Out, PPolicy);
+          tagdecl->getDefinition()->print(Out, Ctx().PPolicy);
           Out << " " << typedecl->getName();
         } else {
-          decl->print(Out, PPolicy);
+          decl->print(Out, Ctx().PPolicy);
         }
       } else {
         MacroInfo *noinline_info = nullptr;
@@ -164,7 +164,7 @@ void PrettyPrint::Print_Decl_Raw(Decl *decl)
           /* If the code has a `noinline` macro defined, it conflicts with
              clang's __attribute__((noinline)) attribute dump.  Hence we
              have to undef it.  */
-          Preprocessor &pp = AST->getPreprocessor();
+          Preprocessor &pp = Ctx().AST->getPreprocessor();
           MacroWalker MW(pp);
 
           /* Get the valid macro at the source location.  */
@@ -175,7 +175,7 @@ void PrettyPrint::Print_Decl_Raw(Decl *decl)
             Out << "#undef noinline\n";
           }
         }
-        decl->print(Out, LangOpts);
+        decl->print(Out, Ctx().LangOpts);
         if (noinline_info) {
           /* Redeclare the macro to the previous value.  */
           PrettyPrint::Print_MacroInfo(noinline_info);
@@ -186,29 +186,30 @@ void PrettyPrint::Print_Decl_Raw(Decl *decl)
     }
   } else {
     /* Else, we fallback to AST Dumping.  */
-    decl->print(Out, LangOpts);
+    decl->print(Out, Ctx().LangOpts);
   }
 }
 
 void PrettyPrint::Debug_Decl(Decl *decl)
 {
 #undef Out
-  auto o = Out;
-  Out = &llvm::outs();
-  Print_Decl(decl);;
-  Out = o;
-#define Out (*Out)
+  PrettyPrintContext &ctx = Ctx();
+  auto o = ctx.Out;
+  ctx.Out = &llvm::outs();
+  Print_Decl(decl);
+  ctx.Out = o;
+#define Out (*Ctx().Out)
 }
 
 void PrettyPrint::Debug_Stmt(Stmt *stmt)
 {
-  stmt->printPretty(llvm::outs(), nullptr, PPolicy);
+  stmt->printPretty(llvm::outs(), nullptr, Ctx().PPolicy);
 }
 
 void PrettyPrint::Print_Stmt(Stmt *stmt)
 {
   /* Currently only used for debugging.  */
-  stmt->printPretty(Out, nullptr, PPolicy);
+  stmt->printPretty(Out, nullptr, Ctx().PPolicy);
   Out << "\n";
 }
 
@@ -254,7 +255,7 @@ void PrettyPrint::Print_MacroInfo(MacroInfo *info)
 
 void PrettyPrint::Print_Attr(Attr *attr)
 {
-  attr->printPretty(llvm::outs(), PPolicy);
+  attr->printPretty(llvm::outs(), Ctx().PPolicy);
   llvm::outs() << '\n';
 }
 
@@ -277,50 +278,74 @@ void PrettyPrint::Print_RawComment(SourceManager &sm, RawComment *comment)
 
 StringRef PrettyPrint::Get_Source_Text(const SourceRange &range)
 {
+    PrettyPrintContext &ctx = Ctx();
+    auto key = std::make_pair(range.getBegin(), range.getEnd());
+    auto it = ctx.TextCache.find(key);
+    if (it != ctx.TextCache.end()) {
+      ctx.Stats.TextHits++;
+      return it->second;
+    }
+    ctx.Stats.TextMisses++;
+
     // NOTE: sm.getSpellingLoc() used in case the range corresponds to a macro/preprocessed source.
     // NOTE2: getSpellingLoc() breaks in the case where a macro was asigned to be expanded to typedef.
-    SourceManager &SM = AST->getSourceManager();
+    SourceManager &SM = ctx.AST->getSourceManager();
     auto start_loc = range.getBegin();//SM->getSpellingLoc(range.getBegin());
     auto last_token_loc = range.getEnd();//SM->getSpellingLoc(range.getEnd());
-    auto end_loc = clang::Lexer::getLocForEndOfToken(last_token_loc, 0, SM, LangOpts);
+    auto end_loc = clang::Lexer::getLocForEndOfToken(last_token_loc, 0, SM, ctx.LangOpts);
     auto printable_range = clang::SourceRange{start_loc, end_loc};
-    return Get_Source_Text_Raw(printable_range);
+    StringRef text = Get_Source_Text_Raw(printable_range);
+
+    ctx.TextCache[key] = text;
+    return text;
 }
 
 StringRef PrettyPrint::Get_Source_Text_Raw(const SourceRange &range)
 {
-    SourceManager &SM = AST->getSourceManager();
-    return clang::Lexer::getSourceText(CharSourceRange::getCharRange(range), SM, LangOpts);
+    PrettyPrintContext &ctx = Ctx();
+    SourceManager &SM = ctx.AST->getSourceManager();
+    return clang::Lexer::getSourceText(CharSourceRange::getCharRange(range), SM, ctx.LangOpts);
 }
 
 /** Compare if SourceLocation a is before SourceLocation b in the source code.  */
 bool PrettyPrint::Is_Before(const SourceLocation &a, const SourceLocation &b)
 {
-  BeforeThanCompare<SourceLocation> is_before(AST->getSourceManager());
+  BeforeThanCompare<SourceLocation> is_before(Ctx().AST->getSourceManager());
 
   assert(a.isValid());
   assert(b.isValid());
 
+  /* Locations in the same file can be compared by their offsets.  Macro
+     locations need the SourceManager to order the tokens inside the same
+     expansion.  */
+  if (a.isFileID() && b.isFileID()) {
+    DecodedLoc a_dec = Decode_Loc(a);
+    DecodedLoc b_dec = Decode_Loc(b);
+
+    if (a_dec.File == b_dec.File) {
+      return a_dec.Offset < b_dec.Offset;
+    }
+  }
+
   return is_before(a, b);
 }
 
 void PrettyPrint::Debug_SourceLoc(const SourceLocation &loc)
 {
-  loc.dump(AST->getSourceManager());
+  loc.dump(Ctx().AST->getSourceManager());
 }
 
 bool PrettyPrint::Contains_From_LineCol(const SourceRange &a, const SourceRange &b)
 {
-  SourceManager &SM = AST->getSourceManager();
-  PresumedLoc a_begin = SM.getPresumedLoc(a.getBegin());
-  PresumedLoc a_end   = SM.getPresumedLoc(a.getEnd());
-  PresumedLoc b_begin = SM.getPresumedLoc(b.getBegin());
-  PresumedLoc b_end   = SM.getPresumedLoc(b.getEnd());
+  DecodedLoc a_begin = Decode_Loc(a.getBegin());
+  DecodedLoc a_end   = Decode_Loc(a.getEnd());
+  DecodedLoc b_begin = Decode_Loc(b.getBegin());
+  DecodedLoc b_end   = Decode_Loc(b.getEnd());
 
-  assert(a_begin.getFileID() == a_end.getFileID());
-  assert(b_begin.getFileID() == b_end.getFileID());
+  assert(a_begin.File == a_end.File);
+  assert(b_begin.File == b_end.File);
 
-  if (a_begin.getFileID() != b_begin.getFileID()) {
+  if (a_begin.File != b_begin.File) {
     /* Files are distinct, thus we can't easily determine which comes first.  */
     return false;
   }
@@ -328,19 +353,43 @@ bool PrettyPrint::Contains_From_LineCol(const SourceRange &a, const SourceRange
   bool a_begin_smaller = false;
   bool b_end_smaller = false;
 
-  if ((a_begin.getLine() < b_begin.getLine()) ||
-      (a_begin.getLine() == b_begin.getLine() && a_begin.getColumn() <= b_begin.getColumn())) {
+  if ((a_begin.Line < b_begin.Line) ||
+      (a_begin.Line == b_begin.Line && a_begin.Column <= b_begin.Column)) {
     a_begin_smaller = true;
   }
 
-  if ((b_end.getLine() < a_end.getLine()) ||
-      (b_end.getLine() == a_end.getLine() && b_end.getColumn() <= a_end.getColumn())) {
+  if ((b_end.Line < a_end.Line) ||
+      (b_end.Line == a_end.Line && b_end.Column <= a_end.Column)) {
     b_end_smaller = true;
   }
 
   return a_begin_smaller && b_end_smaller;
 }
 
+PrettyPrint::DecodedLoc PrettyPrint::Decode_Loc(const SourceLocation &loc)
+{
+  PrettyPrintContext &ctx = Ctx();
+  auto it = ctx.LocCache.find(loc);
+  if (it != ctx.LocCache.end()) {
+    ctx.Stats.LocHits++;
+    return it->second;
+  }
+  ctx.Stats.LocMisses++;
+
+  SourceManager &SM = ctx.AST->getSourceManager();
+  PresumedLoc presumed = SM.getPresumedLoc(loc);
+  DecodedLoc decoded;
+
+  /* The FileID of a PresumedLoc is the one of the expansion location.  */
+  decoded.File   = presumed.isValid() ? presumed.getFileID() : FileID();
+  decoded.Offset = SM.getDecomposedExpansionLoc(loc).second;
+  decoded.Line   = presumed.isValid() ? presumed.getLine() : 0;
+  decoded.Column = presumed.isValid() ? presumed.getColumn() : 0;
+
+  ctx.LocCache[loc] = decoded;
+  return decoded;
+}
+
 bool PrettyPrint::Contains(const SourceRange &a, const SourceRange &b)
 {
   if (a.fullyContains(b)) {
@@ -353,11 +402,28 @@ bool PrettyPrint::Contains(const SourceRange &a, const SourceRange &b)
 /** Compare if SourceLocation a is after SourceLocation b in the source code.  */
 bool PrettyPrint::Is_After(const SourceLocation &a, const SourceLocation &b)
 {
-  BeforeThanCompare<SourceLocation> is_before(AST->getSourceManager());
-  return is_before(b, a);
+  return Is_Before(b, a);
 }
 
 SourceLocation PrettyPrint::Get_Expanded_Loc(Decl *decl)
+{
+  SourceRange decl_range = decl->getSourceRange();
+
+  PrettyPrintContext &ctx = Ctx();
+  auto it = ctx.ExpandedLocCache.find(decl);
+  if (it != ctx.ExpandedLocCache.end() && it->second.first == decl_range) {
+    ctx.Stats.ExpandedLocHits++;
+    return it->second.second;
+  }
+  ctx.Stats.ExpandedLocMisses++;
+
+  SourceLocation furthest = Compute_Expanded_Loc(decl);
+  ctx.ExpandedLocCache[decl] = std::make_pair(decl_range, furthest);
+
+  return furthest;
+}
+
+SourceLocation PrettyPrint::Compute_Expanded_Loc(Decl *decl)
 {
   SourceRange decl_range = decl->getSourceRange();
   SourceLocation furthest = decl_range.getEnd();
@@ -379,7 +445,7 @@ SourceLocation PrettyPrint::Get_Expanded_Loc(Decl *decl)
 
     AttrVec &attrvec = decl->getAttrs();
     bool has_attr = false;
-    SourceManager &SM = AST->getSourceManager();
+    SourceManager &SM = Ctx().AST->getSourceManager();
 
     /* Vector type attributes are not encoded in the AttrVec structure, hence
        we have to check for its existence and expand until we match the ';'
@@ -411,7 +477,7 @@ SourceLocation PrettyPrint::Get_Expanded_Loc(Decl *decl)
 
       /* Keep fetching tokens.  */
       while (true) {
-        auto maybe_next_tok = Lexer::findNextToken(head, SM, LangOpts);
+        auto maybe_next_tok = Lexer::findNextToken(head, SM, Ctx().LangOpts);
         Token *tok = ClangCompat_GetTokenPtr(maybe_next_tok);
 
         if (tok == nullptr) {
@@ -451,37 +517,130 @@ SourceLocation PrettyPrint::Get_Expanded_Loc(Decl *decl)
 void PrettyPrint::Set_Output_To(const std::string &path)
 {
   std::error_code ec;
-  static llvm::raw_fd_ostream out(path, ec);
+  PrettyPrintContext &ctx = Ctx();
+  ctx.OutFile = std::make_unique<llvm::raw_fd_ostream>(path, ec);
 
-  Set_Output_Ostream(&out);
+  Set_Output_Ostream(ctx.OutFile.get());
 }
 
 StringRef PrettyPrint::Get_Filename_From_Loc(const SourceLocation &loc)
 {
-  return AST->getSourceManager().getFilename(loc);
+  return Ctx().AST->getSourceManager().getFilename(loc);
 }
 
 OptionalFileEntryRef PrettyPrint::Get_FileEntry(const SourceLocation &loc)
 {
-  SourceManager &SM = AST->getSourceManager();
+  SourceManager &SM = Ctx().AST->getSourceManager();
   return SM.getFileEntryRefForID(SM.getFileID(loc));
 }
 
-/* See PrettyPrint.hh for what they do.  */
-raw_ostream *PrettyPrint::Out = &llvm::outs();
-LangOptions PrettyPrint::LangOpts;
-PrintingPolicy PrettyPrint::PPolicy(LangOpts);
-ASTUnit *PrettyPrint::AST;
+void PrettyPrint::Clear_Caches(void)
+{
+  PrettyPrintContext &ctx = Ctx();
+  ctx.LocCache.clear();
+  ctx.TextCache.clear();
+  ctx.ExpandedLocCache.clear();
 
+  /* The macro history belongs to the previous AST as well.  */
+  MacroHistoryIndex::Clear();
+}
+
+void PrettyPrint::Dump_Cache_Stats(raw_ostream &out)
+{
+  const CacheStats &stats = Ctx().Stats;
+  out << "PrettyPrint cache statistics (hits/misses):\n"
+      << "  Decoded locations:  " << stats.LocHits << '/' << stats.LocMisses << '\n'
+      << "  Source texts:       " << stats.TextHits << '/' << stats.TextMisses << '\n'
+      << "  Expanded locations: " << stats.ExpandedLocHits << '/'
+                                  << stats.ExpandedLocMisses << '\n';
+}
+
+PrettyPrintContext &PrettyPrint::Ctx(void)
+{
+  PrettyPrintContext *ctx = Current;
+  assert(ctx && "No PrettyPrintContext installed in this thread");
+  return *ctx;
+}
+
+void PrettyPrint::Set_AST(ASTUnit *ast)
+{
+  Ctx().AST = ast;
+  /* Locations and source text from the previous AST are now meaningless.  */
+  Clear_Caches();
+}
+
+SourceManager *PrettyPrint::Get_Source_Manager(void)
+{
+  ASTUnit *ast = Ctx().AST;
+  return ast ? &ast->getSourceManager() : nullptr;
+}
+
+LangOptions &PrettyPrint::Get_Lang_Options(void)
+{
+  return Ctx().LangOpts;
+}
+
+void PrettyPrint::Set_Output_Ostream(llvm::raw_ostream *out)
+{
+  Ctx().Out = out;
+}
+
+raw_ostream *PrettyPrint::Get_Output_Ostream(void)
+{
+  return Ctx().Out;
+}
+
+const PrettyPrint::CacheStats &PrettyPrint::Get_Cache_Stats(void)
+{
+  return Ctx().Stats;
+}
+
+void PrettyPrint::Print_Decl_Tree(Decl *decl)
+{
+  PrettyPrintContext &ctx = Ctx();
+  decl->print(*ctx.Out, ctx.PPolicy);
+  *ctx.Out << '\n';
+}
+
+void PrettyPrint::Debug_Decl_Tree(Decl *decl)
+{
+  decl->print(llvm::outs(), Ctx().PPolicy);
+  llvm::outs() << '\n';
+}
+
+/* See PrettyPrint.hh for what they do.  */
+thread_local PrettyPrintContext *PrettyPrint::Current = nullptr;
 
 
 /** --- New RecursivePrint class code.  */
 
+DeclPrint::DeclPrint(ASTUnit *ast)
+  : AST(ast),
+    LoadedCommentsRead(false)
+{
+}
+
+void DeclPrint::Print_With_Location(Decl *decl)
+{
+  SourceManager &sm = AST->getSourceManager();
+  if (decl->getBeginLoc().isValid()) {
+    RawComment *comment = Get_Location_Comment(decl);
+    if (comment == nullptr) {
+      std::string comment = Build_CE_Location_Comment(sm, decl->getBeginLoc());
+      PrettyPrint::Print_Raw(comment);
+    } else {
+      /* Just output what it had.  */
+      PrettyPrint::Print_RawComment(sm, comment);
+    }
+  }
+  PrettyPrint::Print_Decl(decl);
+}
+
 RecursivePrint::RecursivePrint(ASTUnit *ast,
                                std::unordered_set<Decl *> &deps,
                                IncludeTree &it,
                                bool keep_includes)
-  : AST(ast),
+  : DeclPrint(ast),
     ASTIterator(ast, /*skip_macros_in_decl=*/false),
     MW(ast->getPreprocessor()),
     Decl_Deps(deps),
@@ -575,32 +734,89 @@ void RecursivePrint::Print_Decl(Decl *decl)
      carefully to remove what we don't need.  */
   if (NamespaceDecl *namespacedecl = dynamic_cast<NamespaceDecl*>(decl)) {
     if (namespacedecl->isInline()) {
-       (*PrettyPrint::Out)  << "inline ";
+       (*PrettyPrint::Get_Output_Ostream())  << "inline ";
     }
 
-    (*PrettyPrint::Out) <<"namespace " << namespacedecl->getName() << " {\n  ";
+    (*PrettyPrint::Get_Output_Ostream()) <<"namespace " << namespacedecl->getName() << " {\n  ";
 
     /* Iterate on each macro.  */
     for (auto child : namespacedecl->decls()) {
       Print_Decl(child);
     }
-    (*PrettyPrint::Out) << "}\n";
+    (*PrettyPrint::Get_Output_Ostream()) << "}\n";
   } else {
+    Print_With_Location(decl);
+  }
+}
 
-    SourceManager &sm = AST->getSourceManager();
-    ASTContext &ctx = AST->getASTContext();
-    RawComment *comment = ctx.getRawCommentForDeclNoCache(decl);
-    if (decl->getBeginLoc().isValid()) {
-      if (!Have_Location_Comment(sm, comment)) {
-        std::string comment = Build_CE_Location_Comment(sm, decl->getBeginLoc());
-        PrettyPrint::Print_Raw(comment);
-      } else {
-        /* Just output what it had.  */
-        PrettyPrint::Print_RawComment(sm, comment);
+bool DeclPrint::May_Have_Location_Comment(FileID file)
+{
+  SourceManager &sm = AST->getSourceManager();
+
+  if (file.isInvalid()) {
+    return true;
+  }
+
+  auto it = FilesWithLocationComments.find(file);
+  if (it != FilesWithLocationComments.end()) {
+    return it->second;
+  }
+
+  RawCommentList &comments = AST->getASTContext().getRawCommentList();
+  auto *comments_in_file = comments.getCommentsInFile(file);
+
+  /* Comments of loaded files (e.g. from a preamble) are only read by clang
+     when it first searches for the comment of a decl.  Until we see any of
+     them, an empty list tells nothing, so let clang search.  */
+  if (sm.isLoadedFileID(file)) {
+    if (comments_in_file) {
+      LoadedCommentsRead = true;
+    } else if (!LoadedCommentsRead) {
+      return true;
+    }
+  }
+
+  bool found = false;
+  if (comments_in_file) {
+    for (auto &p : *comments_in_file) {
+      if (Have_Location_Comment(sm, p.second)) {
+        found = true;
+        break;
       }
     }
-    PrettyPrint::Print_Decl(decl);
   }
+
+  FilesWithLocationComments[file] = found;
+  return found;
+}
+
+RawComment *DeclPrint::Get_Location_Comment(Decl *decl)
+{
+  SourceManager &sm = AST->getSourceManager();
+
+  /* Location comments only exist if the input was generated by clang-extract
+     itself, so avoid asking clang to search the comment of every decl we
+     print.  Clang looks for the comment in the files of the location of the
+     decl or its begin, either spelled or expanded.  */
+  const SourceLocation locs[] = { decl->getLocation(), decl->getBeginLoc() };
+  bool may_have = false;
+  for (const SourceLocation &loc : locs) {
+    if (loc.isInvalid()) {
+      continue;
+    }
+    if (May_Have_Location_Comment(sm.getFileID(sm.getSpellingLoc(loc))) ||
+        May_Have_Location_Comment(sm.getFileID(sm.getExpansionLoc(loc)))) {
+      may_have = true;
+      break;
+    }
+  }
+
+  if (!may_have) {
+    return nullptr;
+  }
+
+  RawComment *comment = AST->getASTContext().getRawCommentForDeclNoCache(decl);
+  return Have_Location_Comment(sm, comment) ? comment : nullptr;
 }
 
 void RecursivePrint::Print_Macro_Undef(MacroDirective *directive)
@@ -18,6 +18,7 @@
 #include <unordered_set>
 #include <clang/Tooling/Tooling.h>
 #include <llvm/Support/raw_ostream.h>
+#include <llvm/ADT/DenseMap.h>
 
 #include "IncludeTree.hh"
 #include "MacroWalker.hh"
@@ -26,6 +27,7 @@
 using namespace clang;
 
 class RecursivePrint;
+class PrettyPrintContext;
 
 /** @brief Wrapper class to printing clang AST nodes.
  *
@@ -43,11 +45,9 @@ class PrettyPrint
   /** Print Decl node as is, without any kind of processing.  */
   static void Print_Decl_Raw(Decl *decl);
 
-  static inline void Print_Decl_Tree(Decl *decl)
-  { decl->print(*Out, PPolicy); *Out << '\n'; }
+  static void Print_Decl_Tree(Decl *decl);
 
-  static inline void Debug_Decl_Tree(Decl *decl)
-  { decl->print(llvm::outs(), PPolicy); llvm::outs() << '\n'; }
+  static void Debug_Decl_Tree(Decl *decl);
 
   static void Debug_Decl(Decl *decl);
   static void Debug_Stmt(Stmt *stmt);
@@ -82,26 +82,32 @@ class PrettyPrint
 
   static bool Contains(const SourceRange &a, const SourceRange &b);
 
-  static inline void Set_AST(ASTUnit *ast)
-  {
-    AST = ast;
-  }
+  static void Set_AST(ASTUnit *ast);
 
-  static inline SourceManager *Get_Source_Manager(void)
-  {
-    return &AST->getSourceManager();
-  }
+  static SourceManager *Get_Source_Manager(void);
+
+  static LangOptions &Get_Lang_Options(void);
+
+  static void Set_Output_Ostream(llvm::raw_ostream *out);
+
+  static raw_ostream *Get_Output_Ostream(void);
 
-  static inline LangOptions &Get_Lang_Options(void)
+  /** Set the context used by PrettyPrint in the calling thread.  Using
+      PrettyPrint while no context is set is a bug.  */
+  static inline void Set_Context(PrettyPrintContext *ctx)
   {
-    return LangOpts;
+    Current = ctx;
   }
 
-  static void Set_Output_Ostream(llvm::raw_ostream *out)
+  static inline PrettyPrintContext *Get_Context(void)
   {
-    Out = out;
+    return Current;
   }
 
+  /** Get the context in use by the calling thread.  One must be installed
+      through a PrettyPrintContext::Scope.  */
+  static PrettyPrintContext &Ctx(void);
+
   /** Gets the portion of the code that corresponds to given SourceRange, including the
       last token. Returns expanded macros.
 
@@ -137,6 +143,23 @@ class PrettyPrint
 
   static OptionalFileEntryRef Get_FileEntry(const SourceLocation &loc);
 
+  /** Hit and miss counters of the caches used to avoid decoding the same
+      locations and extracting the same source text over and over.  */
+  struct CacheStats
+  {
+    unsigned long LocHits;
+    unsigned long LocMisses;
+    unsigned long TextHits;
+    unsigned long TextMisses;
+    unsigned long ExpandedLocHits;
+    unsigned long ExpandedLocMisses;
+  };
+
+  static const CacheStats &Get_Cache_Stats(void);
+
+  /** Dump the cache counters into out.  */
+  static void Dump_Cache_Stats(raw_ostream &out);
+
   /* This class can not be initialized.  */
   PrettyPrint() = delete;
 
@@ -144,23 +167,110 @@ class PrettyPrint
 
   static bool Is_Range_Valid(const SourceRange &loc);
 
-  /** Output object to where this class will output to.  Current default is the
-      same as llvm::outs().  */
-  static raw_ostream *Out;
+  /** A SourceLocation decoded into the FileID and offset of its expansion
+      location, and its presumed line and column.  */
+  struct DecodedLoc
+  {
+    FileID File;
+    unsigned Offset;
+    unsigned Line;
+    unsigned Column;
+  };
+
+  /** Decode loc, looking into the cache first.  */
+  static DecodedLoc Decode_Loc(const SourceLocation &loc);
+
+  /** Compute the furthest location of decl, without looking into the cache.  */
+  static SourceLocation Compute_Expanded_Loc(Decl *decl);
+
+  /** Drop every cached entry.  Must be called whenever the AST changes.  */
+  static void Clear_Caches(void);
+
+  /** Context in use by the calling thread, or nullptr if none.  */
+  static thread_local PrettyPrintContext *Current;
+
+  friend class RecursivePrint;
+  friend class PrettyPrintContext;
+};
+
+/** @brief State of PrettyPrint.
+ *
+ * PrettyPrint is used through static methods, but everything it holds lives
+ * in a context.  Each extraction owns one and installs it in the threads
+ * working on it, so extractions running in the same process at once do not
+ * share the AST, the output stream or the caches.
+ */
+class PrettyPrintContext
+{
+  public:
+  PrettyPrintContext(void)
+    : AST(nullptr),
+      Out(&llvm::outs()),
+      LangOpts(),
+      PPolicy(LangOpts),
+      Stats()
+  {
+  }
+
+  PrettyPrintContext(const PrettyPrintContext &) = delete;
+  void operator=(const PrettyPrintContext &) = delete;
+
+  /** Install a context in the calling thread for the lifetime of this
+      object.  */
+  class Scope
+  {
+    public:
+    Scope(PrettyPrintContext *ctx)
+      : Previous(PrettyPrint::Get_Context())
+    {
+      PrettyPrint::Set_Context(ctx);
+    }
+
+    ~Scope(void)
+    {
+      PrettyPrint::Set_Context(Previous);
+    }
+
+    Scope(const Scope &) = delete;
+    void operator=(const Scope &) = delete;
+
+    private:
+    PrettyPrintContext *Previous;
+  };
+
+  /** ASTUnit object.  Must be set after constructing the ast by calling
+      PrettyPrint::Set_AST.  */
+  ASTUnit *AST;
+
+  /** Output object to where PrettyPrint will output to.  Current default is
+      the same as llvm::outs().  */
+  raw_ostream *Out;
+
+  /** File opened by PrettyPrint::Set_Output_To.  */
+  std::unique_ptr<llvm::raw_fd_ostream> OutFile;
 
   /** Language options used by clang's internal PrettyPrinter.  We use the
       default options for now.  */
-  static LangOptions LangOpts;
+  LangOptions LangOpts;
 
   /** Policy for printing.  We use the default for now.  */
-  static PrintingPolicy PPolicy;
+  PrintingPolicy PPolicy;
 
-  /** ASTUnit object.  Must be set after constructing the ast by
-      calling Set_Source_Manager.  FIXME: This should not be a statc
-      class variable.  Refactor this class entirely.  */
-  static ASTUnit *AST;
+  /** Cache of decoded SourceLocations.  */
+  llvm::DenseMap<SourceLocation, PrettyPrint::DecodedLoc> LocCache;
 
-  friend class RecursivePrint;
+  /** Cache of source texts, indexed by the range given to Get_Source_Text.  */
+  llvm::DenseMap<std::pair<SourceLocation, SourceLocation>, StringRef> TextCache;
+
+  /** Cache of Get_Expanded_Loc results, together with the range of the decl
+      when it was computed.  Passes may change the range of a decl.  */
+  llvm::DenseMap<Decl *, std::pair<SourceRange, SourceLocation>> ExpandedLocCache;
+
+  /** Cache counters.  */
+  PrettyPrint::CacheStats Stats;
+
+  /** History of the macros of AST, shared by every MacroWalker.  */
+  std::shared_ptr<MacroHistoryIndex> MacroIndex;
 };
 
 /** Since writing PrettyPrint::Print_Decl can be bothering and result in
@@ -180,7 +290,37 @@ static inline bool Is_Loc_Before(const SourceLocation &a, const SourceLocation &
   return PrettyPrint::Is_Before(a, b);
 }
 
-class RecursivePrint
+/** @brief Print single decls preceded by their location comment.
+ *
+ * This is what RecursivePrint does for each marked decl, without walking the
+ * translation unit, hence it needs neither an IncludeTree nor the
+ * preprocessing record.  Useful to print a known list of decls.
+ */
+class DeclPrint
+{
+  public:
+  DeclPrint(ASTUnit *ast);
+
+  /** Print decl preceded by its clang-extract location comment.  */
+  void Print_With_Location(Decl *decl);
+
+  protected:
+  /** Get the clang-extract location comment of decl, if it has one.  */
+  RawComment *Get_Location_Comment(Decl *decl);
+
+  /** Check if any comment in file is a clang-extract location comment.  */
+  bool May_Have_Location_Comment(FileID file);
+
+  ASTUnit *AST;
+
+  /* Memoized result of May_Have_Location_Comment.  */
+  llvm::DenseMap<FileID, bool> FilesWithLocationComments;
+
+  /* Have clang read the comments of the loaded files already?  */
+  bool LoadedCommentsRead;
+};
+
+class RecursivePrint : public DeclPrint
 {
   public:
   RecursivePrint(ASTUnit *ast,
@@ -222,7 +362,6 @@ class RecursivePrint
   inline void Unmark_Macro(MacroInfo *x)
   { x->setIsUsed(false); }
 
-  ASTUnit *AST;
   TopLevelASTIterator ASTIterator;
   MacroWalker MW;
   std::unordered_set<Decl *> &Decl_Deps;
@@ -18,11 +18,12 @@
 #include "Error.hh"
 #include "ClangCompat.hh"
 #include "LLVMMisc.hh"
-#include "IntervalTree.hh"
 #include "Closure.hh"
 
 #include <unordered_set>
 #include <iostream>
+#include <algorithm>
+#include <tuple>
 
 #include "clang/Rewrite/Core/Rewriter.h"
 
@@ -41,9 +42,34 @@
 /* Return the ranges for all identifiers on the ids vector */
 template <typename T>
 static std::vector<std::pair<std::string, SourceRange>>
-Get_Range_Of_Identifier(const SourceRange &range, const T &ids)
+Get_Range_Of_Identifier(IdentifierTokenIndex &index, const SourceRange &range,
+                        const T &ids)
 {
   std::vector< std::pair < std::string, SourceRange> > ret = {};
+
+  /* If the range is in a file, its identifiers were already lexed.  Else, or
+     if its ends are in different files, tokenize its text below.  */
+  VectorRef<IdentifierTokenIndex::IdentifierToken> toks(nullptr, 0U);
+  if (index.Get_Identifiers_In_Range(range, toks)) {
+    SourceManager *sm = PrettyPrint::Get_Source_Manager();
+    unsigned range_offset = sm->getFileOffset(range.getBegin());
+
+    for (unsigned i = 0; i < toks.getSize(); i++) {
+      const IdentifierTokenIndex::IdentifierToken &tok = toks.getPointer()[i];
+      StringRef name = tok.Info->getName();
+      if (ids.find(name) != ids.end()) {
+        /* Compute the distance from the original SourceRange.  */
+        int32_t offset = (int32_t) (tok.Offset - range_offset);
+        SourceLocation start = range.getBegin().getLocWithOffset(offset);
+        SourceLocation end = start.getLocWithOffset(tok.Length - 1);
+        ret.push_back(std::make_pair(name.str(), SourceRange(start, end)));
+      }
+    }
+
+    return ret;
+  }
+
+  /* Else tokenize the text of the range.  */
   StringRef string = PrettyPrint::Get_Source_Text(range);
 
   /* Create temporary buff, strtok modifies it.  */
@@ -76,10 +102,11 @@ Get_Range_Of_Identifier(const SourceRange &range, const T &ids)
 }
 
 static std::vector<std::pair<std::string, SourceRange>>
-Get_Range_Of_Identifier(const SourceRange &range, const StringRef &id)
+Get_Range_Of_Identifier(IdentifierTokenIndex &index, const SourceRange &range,
+                        const StringRef &id)
 {
   std::set<StringRef> ids = { id };
-  return Get_Range_Of_Identifier(range, ids);
+  return Get_Range_Of_Identifier(index, range, ids);
 }
 
 #define EXTERNALIZED_PREFIX "klpe_"
@@ -88,9 +115,6 @@ Get_Range_Of_Identifier(const SourceRange &range, const StringRef &id)
 using namespace clang;
 using namespace llvm;
 
-/* IntervalTree.  */
-using namespace Intervals;
-
 class ExternalizerVisitor: public RecursiveASTVisitor<ExternalizerVisitor>
 {
   public:
@@ -157,8 +181,8 @@ class ExternalizerVisitor: public RecursiveASTVisitor<ExternalizerVisitor>
       }
     } else if (type == ExternalizationType::RENAME) {
       /* Get SourceRange where the function identifier is.  */
-      auto ids = Get_Range_Of_Identifier(decl->getSourceRange(),
-                                                     decl->getName());
+      auto ids = Get_Range_Of_Identifier(SE.Tokens, decl->getSourceRange(),
+                                         decl->getName());
       assert(ids.size() > 0 && "Decl name do not match required identifier?");
 
       SourceRange id_range = ids[0].second;
@@ -213,10 +237,8 @@ class ExternalizerVisitor: public RecursiveASTVisitor<ExternalizerVisitor>
        will not be removed by the Closure.  */
     if (sym->FirstUse == nullptr) {
       ClosureSet &closure = SE.ClosureVisitor.Get_Closure();
-      ASTUnit *ast = SE.AST;
-      SourceManager &sm = ast->getSourceManager();
-      SourceLocation loc = sm.getExpansionLoc(expr->getLocation());
-      Decl *topdecl = Get_Toplevel_Decl_At_Location(ast, loc);
+      TopLevelDeclIndex &index = SE.ClosureVisitor.Get_Toplevel_Index();
+      Decl *topdecl = index.Get_Decl_At_Location(expr->getLocation());
 
       /* If the declaration is reachable from the functions we want to extract,
          then we mark it as FirstUse.  */
@@ -267,7 +289,7 @@ static SourceRange Get_Range_For_Rewriter(const ASTUnit *ast, const SourceRange
 bool SymbolExternalizer::Drop_Static(FunctionDecl *decl)
 {
   if (decl->isStatic()) {
-    auto ids = Get_Range_Of_Identifier(decl->getSourceRange(), StringRef("static"));
+    auto ids = Get_Range_Of_Identifier(Tokens, decl->getSourceRange(), StringRef("static"));
     assert(ids.size() > 0 && "static decl without static keyword?");
 
     SourceRange static_range = ids[0].second;
@@ -286,7 +308,7 @@ template <typename DECL>
 bool SymbolExternalizer::Drop_Static_Add_Extern(DECL *decl)
 {
   if (decl->getStorageClass() == StorageClass::SC_Static) {
-    auto ids = Get_Range_Of_Identifier(decl->getSourceRange(), StringRef("static"));
+    auto ids = Get_Range_Of_Identifier(Tokens, decl->getSourceRange(), StringRef("static"));
     assert(ids.size() > 0 && "static decl without static keyword?");
 
     SourceRange static_range = ids[0].second;
@@ -320,76 +342,85 @@ bool SymbolExternalizer::Add_Extern(DECL *decl)
 /* ---- Delta and TextModifications class ------ */
 
 
-TextModifications::Delta::Delta(const SourceRange &to_change,
-                                const std::string &new_text, int prio)
-      : ToChange(to_change),
-        NewText(new_text),
-        Priority(prio)
+void TextModifications::Insert(const SourceRange &to_change, StringRef new_text,
+                               int prio)
 {
-  static int curr_id = 0;
-  ID = curr_id++;
-}
-
-void TextModifications::Sort(void)
-{
-  auto comparator = [](const Delta& a, const Delta &b) {
-    return a.Priority > b.Priority;
-  };
+  /* Compute where in its file the change is.  The rewriter replaces the text
+     between begin and end, which is nothing if end is not in the same file.  */
+  std::pair<FileID, unsigned> begin = SM.getDecomposedLoc(to_change.getBegin());
+  std::pair<FileID, unsigned> end = SM.getDecomposedLoc(to_change.getEnd());
+  unsigned end_offset = begin.second;
+  if (end.first == begin.first && end.second > begin.second) {
+    end_offset = end.second;
+  }
 
-  /* Sort by descending priority (larger comes first).  */
-  std::sort(DeltaList.begin(), DeltaList.end(), comparator);
+  StringRef text = new_text.empty() ? StringRef() : Saver.save(new_text);
+  DeltaList.emplace_back(to_change, text, prio, DeltaList.size(),
+                         begin.first, begin.second, end_offset);
 }
 
-void TextModifications::Insert(Delta &delta)
+void TextModifications::Solve_Intersecting(size_t first, size_t last)
 {
-  /* Insert into the vector.  */
-  DeltaList.push_back(delta);
+  /* Consider the changes by descending priority, then by insertion order.  */
+  SmallVector<Delta *, 8> order;
+  for (size_t i = first; i < last; i++) {
+    order.push_back(&DeltaList[i]);
+  }
+  std::sort(order.begin(), order.end(), [](const Delta *a, const Delta *b) {
+    if (a->Priority != b->Priority) {
+      return a->Priority > b->Priority;
+    }
+    return a->ID < b->ID;
+  });
+
+  /* A change stays if it does not intersect any change which stayed with
+     a higher priority.  */
+  SmallVector<const Delta *, 8> kept;
+  for (Delta *a : order) {
+    for (const Delta *b : kept) {
+      if (Delta::Intersects(*a, *b)) {
+        a->Discarded = true;
+        break;
+      }
+    }
+
+    if (!a->Discarded) {
+      kept.push_back(a);
+    }
+  }
 }
 
 void TextModifications::Solve(void)
 {
-  /* Interval Tree to compute intersections of changes.  We can't have
-     intersections so if we find those we try to solve them.  */
-  IntervalTree<SourceLocation, const Delta&> interval_tree;
-  std::vector<Delta> new_arr;
-
-  /* Sort so that the highest priorities comes first.  */
-  Sort();
-
-  /* Get how many Text Modifications we desire.  */
-  int n = DeltaList.size();
-
-  /* Given one Text Modification, we must check if there is another text
-     modification that intersects with this one.  If there is, we must
-     remove the one with smaller priority (the one that is later on the
-     vector because we sorted it).
+  /* Sort the changes by their position in the file they change.  Then any
+     group of changes intersecting each other is contiguous.  */
+  std::sort(DeltaList.begin(), DeltaList.end(), [](const Delta &a, const Delta &b) {
+    return std::tie(a.File, a.Begin, a.End, a.ID) <
+           std::tie(b.File, b.Begin, b.End, b.ID);
+  });
+
+  size_t n = DeltaList.size();
+  size_t i = 0;
+  while (i < n) {
+    /* Find the changes which transitively intersect the i-th one.  */
+    size_t j = i + 1;
+    unsigned end = DeltaList[i].End;
+    while (j < n && DeltaList[j].File == DeltaList[i].File &&
+           DeltaList[j].Begin <= end) {
+      end = std::max(end, DeltaList[j].End);
+      j++;
+    }
 
-     Use an Interval Tree to reduce the complexity from O(n(n-1)/2) to
-     O(n log n).  */
-  for (int i = 0; i < n; i++) {
-    const Delta &a = DeltaList[i];
-    auto overlap = interval_tree.findOverlappingIntervals(a.ToChange);
-    /* Check if we already have this range in the tree.  */
-    if (overlap.size() > 0) {
-      const Delta &b = overlap[0].value;
-
-      if (a.Priority <= b.Priority || a == b) {
-        // Ignore.
-      } else {
-        /* Intersection with the same priority. Issue an error -- we can't have this.  */
-        DiagsClass::Emit_Error("Rewriter ranges with same priority intersects");
-        DiagsClass::Emit_Note(" This one: (priority " + std::to_string(a.Priority) + ')',
-                              a.ToChange);
-        DiagsClass::Emit_Note("with this: (priority " + std::to_string(b.Priority) + ')',
-                              b.ToChange);
-        throw std::runtime_error("SymbolExternalizer can not continue.");
-      }
-    } else {
-      interval_tree.insert(Interval<SourceLocation, const Delta&>(a.ToChange, a));
-      new_arr.push_back(a);
+    if (j - i > 1) {
+      Solve_Intersecting(i, j);
     }
+    i = j;
   }
-  DeltaList = new_arr;
+
+  /* Drop the discarded changes in place.  */
+  DeltaList.erase(std::remove_if(DeltaList.begin(), DeltaList.end(),
+                                 [](const Delta &a) { return a.Discarded; }),
+                  DeltaList.end());
 }
 
 bool TextModifications::Insert_Into_FileEntryMap(const SourceLocation &loc)
@@ -449,17 +480,15 @@ void TextModifications::Commit(void)
     Delta &a = DeltaList[i];
 
     /* Try to insert into the FileEntryMap for commiting the change to the buffer
-       later.  */
-    Insert_Into_FileEntryMap(a.ToChange);
-
-    /* Get the text we want to change.  We only do this to know its length.  */
-    StringRef source_text = Lexer::getSourceText(CharSourceRange::getCharRange(
-                                                 a.ToChange),
-                                                 SM, LO);
-    unsigned len = source_text.size();
+       later.  Changes are grouped by file, so once per file is enough.  */
+    if (i == 0 || DeltaList[i-1].File != a.File) {
+      Insert_Into_FileEntryMap(a.ToChange);
+    }
 
     /* ReplaceText(SourceRange, StringRef) version is unreliable in llvm-16.  */
-    assert(RW.ReplaceText(a.ToChange.getBegin(), len, a.NewText) == false);
+    bool failed = RW.ReplaceText(a.ToChange.getBegin(), a.End - a.Begin, a.NewText);
+    assert(!failed && "Rewriter rejected the change");
+    (void) failed;
 
     if (DumpingEnabled) {
       Dump(i, a);
@@ -476,7 +505,7 @@ void TextModifications::Dump(unsigned num, const Delta &a)
 
   std::string note = std::to_string(num) + " Changing " +
                 PrettyPrint::Get_Source_Text_Raw(a.ToChange).str() +
-                " to " + a.NewText;
+                " to " + a.NewText.str();
   note = "/*\n" + note + "*/\n";
   fputs(note.c_str(), file);
 
@@ -506,53 +535,12 @@ void TextModifications::Dump(unsigned num, const Delta &a)
   fclose(file);
 }
 
-bool TextModifications::Is_Before_Or_Equal(const PresumedLoc &a, const PresumedLoc &b)
-{
-  unsigned a_line = a.getLine();
-  unsigned a_col  = a.getColumn();
-  unsigned b_line = b.getLine();
-  unsigned b_col  = b.getColumn();
-
-  unsigned m = std::max(a_col, b_col);
-  unsigned psi_a = m*a_line + a_col;
-  unsigned psi_b = m*b_line + b_col;
-
-  return psi_a <= psi_b;
-}
-
-bool TextModifications::Intersects(const SourceRange &a, const SourceRange &b)
-{
-  PresumedLoc a_begin = SM.getPresumedLoc(a.getBegin());
-  PresumedLoc a_end   = SM.getPresumedLoc(a.getEnd());
-  PresumedLoc b_begin = SM.getPresumedLoc(b.getBegin());
-  PresumedLoc b_end   = SM.getPresumedLoc(b.getEnd());
-
-  assert(a_begin.getFileID() == a_end.getFileID());
-  assert(b_begin.getFileID() == b_end.getFileID());
-
-  if (a_begin.getFileID() != b_begin.getFileID()) {
-    /* Files are distinct, thus we can't easily determine which comes first.  */
-    return false;
-  }
-
-  assert(a_begin.getLine() <= a_end.getLine());
-  assert(b_begin.getLine() <= b_end.getLine());
-
-  return Is_Before_Or_Equal(a_begin, b_end) && Is_Before_Or_Equal(b_begin, a_end);
-}
-
-bool TextModifications::Intersects(const Delta &a, const Delta &b)
-{
-  return Intersects(a.ToChange, b.ToChange);
-}
-
 /* ---- End of Deltas class -------- */
 
 void SymbolExternalizer::Replace_Text(const SourceRange &range, StringRef new_name, int prio)
 {
   SourceRange rw_range = Get_Range_For_Rewriter(AST, range);
-  TextModifications::Delta delta(rw_range, new_name.str(), prio);
-  TM.Insert(delta);
+  TM.Insert(rw_range, new_name, prio);
 }
 
 void SymbolExternalizer::Remove_Text(const SourceRange &range, int prio)
@@ -636,6 +624,26 @@ VarDecl *SymbolExternalizer::Create_Externalized_Var(DeclaratorDecl *decl, const
   return ret;
 }
 
+/** Apply the changes in buf into a single buffer, sized upfront.  The pieces
+    of the rope are copied directly, without going through a temporary
+    string.  */
+static std::unique_ptr<MemoryBuffer>
+Apply_Rewrite_Buffer(const RewriteBuffer &buf, StringRef name)
+{
+  std::unique_ptr<WritableMemoryBuffer> out =
+    WritableMemoryBuffer::getNewUninitMemBuffer(buf.size(), name);
+  char *ptr = out->getBufferStart();
+
+  for (auto it = buf.begin(), end = buf.end(); it != end; it.MoveToNextPiece()) {
+    StringRef piece = it.piece();
+    memcpy(ptr, piece.data(), piece.size());
+    ptr += piece.size();
+  }
+
+  assert(ptr == out->getBufferEnd() && "Rewrite buffer size mismatch");
+  return out;
+}
+
 bool SymbolExternalizer::Commit_Changes_To_Source(
                           IntrusiveRefCntPtr<llvm::vfs::OverlayFileSystem> &ofs,
                           IntrusiveRefCntPtr<llvm::vfs::InMemoryFileSystem> &mfs,
@@ -645,6 +653,8 @@ bool SymbolExternalizer::Commit_Changes_To_Source(
   bool modified = false;
   bool main_file_inserted = false;
 
+  /* The filesystems must be new, as the InMemoryFileSystem can not replace
+     the files already added to it.  */
   auto new_ofs = IntrusiveRefCntPtr<vfs::OverlayFileSystem>(
                        new vfs::OverlayFileSystem(vfs::getRealFileSystem()));
 
@@ -657,7 +667,7 @@ bool SymbolExternalizer::Commit_Changes_To_Source(
   TM.Commit();
 
   Rewriter &RW = TM.Get_Rewriter();
-  auto FileEntryMap = TM.Get_FileEntry_Map();
+  const auto &FileEntryMap = TM.Get_FileEntry_Map();
 
   /* Iterate into all files we may have opened, most probably headers that are
      #include'd.  */
@@ -675,14 +685,9 @@ bool SymbolExternalizer::Commit_Changes_To_Source(
     /* If we have modifications, then update the buffer.  */
     if (rewritebuf) {
       /* The RewriteBuffer object contains a sequence of deltas of the original
-         buffer.  Clearly a faster way would be apply those deltas into the
-         target buffer directly, but clang doesn't seems to provide such
-         interface, so we expand them into a temporary string and them pass
-         it to the SourceManager.  */
-      std::string modified_str = std::string(rewritebuf->begin(), rewritebuf->end());
-
-      if (new_mfs->addFile(fentry->getName(),
-                       0, MemoryBuffer::getMemBufferCopy(modified_str)) == false) {
+         buffer.  Apply them into the buffer given to the filesystem.  */
+      if (new_mfs->addFile(fentry->getName(), 0,
+                           Apply_Rewrite_Buffer(*rewritebuf, fentry->getName())) == false) {
         llvm::outs() << "Unable to add " << fentry->getName() << " into InMemoryFS.\n";
       }
 
@@ -702,10 +707,9 @@ bool SymbolExternalizer::Commit_Changes_To_Source(
   if (main_file_inserted == false) {
       FileID id = sm.getMainFileID();
       const FileEntry *fentry = sm.getFileEntryForID(id);
-      const std::string &main_file_content = Get_Modifications_To_Main_File();
-      if (new_mfs->addFile(fentry->getName(),
-                       0,
-                       MemoryBuffer::getMemBufferCopy(main_file_content)) == false) {
+      const RewriteBuffer &main_buf = RW.getEditBuffer(id);
+      if (new_mfs->addFile(fentry->getName(), 0,
+                           Apply_Rewrite_Buffer(main_buf, fentry->getName())) == false) {
         llvm::outs() << "Unable to add " << fentry->getName() << " into InMemoryFS.\n";
       }
   }
@@ -730,19 +734,37 @@ std::string SymbolExternalizer::Get_Modifications_To_Main_File(void)
 }
 
 /** Given a MacroExpansion object, we try to get the location of where the token
-    appears on it.
-
-    TODO: clang may provide a way of doing this with a tokenizer, so maybe this
-    code can become cleaner with it.  */
+    appears on it.  The tokens of the file were lexed once by the
+    IdentifierTokenIndex.  */
 std::vector<std::pair<std::string, SourceRange>>
 SymbolExternalizer::Get_Range_Of_Identifier_In_Macro_Expansion(const MacroExpansion *exp)
 {
-  return Get_Range_Of_Identifier(exp->getSourceRange(), SymbolsMap);
+  return Get_Range_Of_Identifier(Tokens, exp->getSourceRange(), SymbolsMap);
 }
 
 void SymbolExternalizer::Rewrite_Macros(void)
 {
-  PreprocessingRecord *rec = AST->getPreprocessor().getPreprocessingRecord();
+  Preprocessor &pp = AST->getPreprocessor();
+  PreprocessingRecord *rec = pp.getPreprocessingRecord();
+  IdentifierTable &idtbl = pp.getIdentifierTable();
+
+  /* Identifiers of the symbols which names change.  Any other token can be
+     discarded with a single probe, before looking for a macro with its
+     name.  */
+  llvm::DenseSet<const IdentifierInfo *> renamed;
+  for (auto &entry : SymbolsMap) {
+    if (entry.second.Needs_Sym_Rename()) {
+      auto id = idtbl.find(entry.first());
+      if (id != idtbl.end()) {
+        renamed.insert(id->getValue());
+      }
+    }
+  }
+
+  /* No token can refer to a symbol which name changes.  */
+  if (renamed.empty()) {
+    return;
+  }
 
   for (PreprocessedEntity *entity : *rec) {
     if (MacroDefinitionRecord *def = dyn_cast<MacroDefinitionRecord>(entity)) {
@@ -753,7 +775,7 @@ void SymbolExternalizer::Rewrite_Macros(void)
 
       for (const Token tok : info->tokens()) {
         IdentifierInfo *id_info = tok.getIdentifierInfo();
-        if (!id_info)
+        if (!id_info || !renamed.contains(id_info))
           continue;
 
         MacroInfo *maybe_macro = MW.Get_Macro_Info(id_info, def->getLocation());
@@ -847,7 +869,7 @@ void SymbolExternalizer::Compute_SymbolsMap_Late_Insert_Locations(std::vector<Sy
 
     SourceLocation loc_1stuse = SM.getExpansionLoc(first_use->getLocation());
 
-    Decl *topdecl = Get_Toplevel_Decl_At_Location(AST, loc_1stuse);
+    Decl *topdecl = ClosureVisitor.Get_Toplevel_Index().Get_Decl_At_Location(loc_1stuse);
     assert(topdecl && "No Toplevel decl encapsulate given expr?");
 
     /* Check if the declaration have comments.  In this case we want to insert
@@ -1002,6 +1024,10 @@ void SymbolExternalizer::Late_Externalize(void)
 void SymbolExternalizer::Externalize_Symbols(std::vector<std::string> const &to_externalize_array,
                                               std::vector<std::string> &to_rename_array)
 {
+  /* Resolve all symbols at once, so Get_Symbol_Ext_Type finds them
+     memoized.  */
+  IA.Resolve_Symbols(to_externalize_array);
+
   for (const std::string &to_externalize : to_externalize_array) {
     SymbolsMap.insert({to_externalize, SymbolUpdateStatus(Get_Symbol_Ext_Type(to_externalize))});
   }
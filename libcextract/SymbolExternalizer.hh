@@ -22,6 +22,8 @@
 #include <clang/Tooling/Tooling.h>
 #include <clang/Rewrite/Core/Rewriter.h>
 #include "llvm/ADT/StringMap.h"
+#include "llvm/Support/Allocator.h"
+#include "llvm/Support/StringSaver.h"
 
 using namespace clang;
 
@@ -152,6 +154,9 @@ struct SymbolUpdateStatus
  *  removes content to be the highest priority, and the ones which only changes
  *  the name of things to be the lowest priority.  Hence at some point we compute
  *  the insersection of all with all and discards the ones with lower priority.
+ *
+ *  Changes are compared by their offsets in the file they change, so finding
+ *  the intersections is a sort followed by a linear sweep.
  */
 class TextModifications
 {
@@ -159,13 +164,16 @@ class TextModifications
   /** A delta -- a single text modification.  */
   struct Delta
   {
-    Delta(const SourceRange &to_change, const std::string &new_text, int prio);
-
-    Delta(void)
-      : ToChange(),
-        NewText(),
-        Priority(0),
-        ID(0)
+    Delta(const SourceRange &to_change, StringRef new_text, int prio,
+          unsigned id, FileID file, unsigned begin, unsigned end)
+      : ToChange(to_change),
+        NewText(new_text),
+        Priority(prio),
+        ID(id),
+        File(file),
+        Begin(begin),
+        End(end),
+        Discarded(false)
     {
     }
 
@@ -175,27 +183,36 @@ class TextModifications
       return a.ToChange == b.ToChange && a.NewText == b.NewText;
     }
 
-    bool operator<(const Delta& other) const
+    bool operator==(const Delta &other) const
     {
-      return !(Is_Same_Change(*this, other));
+      return Is_Same_Change(*this, other);
     }
 
-    bool operator==(const Delta &other) const
+    /* Check if two changes touch the same piece of text.  */
+    static bool Intersects(const Delta &a, const Delta &b)
     {
-      return Is_Same_Change(*this, other);
+      return a.File == b.File && a.Begin <= b.End && b.Begin <= a.End;
     }
 
     /* Which part of the original code should be changed?  */
     SourceRange ToChange;
 
-    /* With what text?  */
-    std::string NewText;
+    /* With what text?  Owned by the TextModifications object.  */
+    StringRef NewText;
 
     /* What is the priority of this change?  */
     int Priority;
 
-    /* ID.  */
-    int ID;
+    /* Order of insertion.  Breaks ties between changes with same priority.  */
+    unsigned ID;
+
+    /* File and offsets of ToChange in it.  */
+    FileID File;
+    unsigned Begin;
+    unsigned End;
+
+    /* Set when the change was discarded in favour of another.  */
+    bool Discarded;
   };
 
   /** Constructor for the TextModification class.  */
@@ -203,7 +220,8 @@ class TextModifications
     : SM(ast->getSourceManager()),
       LO(ast->getLangOpts()),
       RW(SM, LO),
-      DumpingEnabled(dump)
+      DumpingEnabled(dump),
+      Saver(TextArena)
   {}
 
   /** Get underlying Rewriter class.  */
@@ -212,8 +230,8 @@ class TextModifications
     return RW;
   }
 
-  /* Insert a text modification.  */
-  void Insert(Delta &delta);
+  /* Insert a text modification replacing to_change with new_text.  */
+  void Insert(const SourceRange &to_change, StringRef new_text, int prio);
 
   /* Solve the modifications according to their priorities and apply to clang's
      Rewriter class instance.  */
@@ -237,18 +255,9 @@ class TextModifications
   /* Solve the modifications according to their priorities.  */
   void Solve(void);
 
-  /* Sort the DeltaLists (sequence of text modifications) according to their
-     priorities.  */
-  void Sort(void);
-
-  /* Checks if two SourceRanges intersects.  */
-  bool Intersects(const SourceRange &a, const SourceRange &b);
-
-  /* Check if two Deltas (text modifications) intersects.  */
-  bool Intersects(const Delta &a, const Delta &b);
-
-  /* Check which SourceLocation comes first.  */
-  bool Is_Before_Or_Equal(const PresumedLoc &a, const PresumedLoc &b);
+  /* Keep only the change with highest priority among the changes in
+     [first, last) which intersect each other.  */
+  void Solve_Intersecting(size_t first, size_t last);
 
   /* Reference to the AST SourceManager.  */
   SourceManager &SM;
@@ -265,6 +274,10 @@ class TextModifications
   /* The list of Text Modifications we want to do.  */
   std::vector<Delta> DeltaList;
 
+  /* Storage for the text of the changes.  */
+  llvm::BumpPtrAllocator TextArena;
+  llvm::StringSaver Saver;
+
   /* Our own mapping from FileEntry to FileID to get the modifications to the
      files.  */
   std::unordered_map<const FileEntry *, FileID> FileEntryMap;
@@ -304,7 +317,8 @@ class SymbolExternalizer
       AllowLateExternalization(allow_late_externalize),
       PatchObject(patch_object),
       SymbolsMap({}),
-      ClosureVisitor(ast)
+      ClosureVisitor(ast),
+      Tokens(ast)
   {
     ClosureVisitor.Compute_Closure_Of_Symbols(functions_to_extract);
   }
@@ -430,4 +444,8 @@ class SymbolExternalizer
 
   /* ClosureVisitor to compute the closure.  */
   DeclClosureVisitor ClosureVisitor;
+
+  /* Identifiers of the files, to find where a name is in a decl or macro
+     expansion.  */
+  IdentifierTokenIndex Tokens;
 };
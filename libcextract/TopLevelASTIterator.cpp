@@ -15,22 +15,27 @@
 
 #include "TopLevelASTIterator.hh"
 
+#include <algorithm>
+
 TopLevelASTIterator::TopLevelASTIterator(ASTUnit *ast, bool skip_macros_in_decls)
   : AST(ast),
     SM(AST->getSourceManager()),
     PrepRec(*AST->getPreprocessor().getPreprocessingRecord()),
-    DeclIt(AST->top_level_begin()),
-    MacroIt(PrepRec.begin()),
-    UndefIt(0),
     NeedsUndef({}),
+    Index(0),
     BeforeClass(SM),
     MW(AST->getPreprocessor()),
     SkipMacrosInDecls(skip_macros_in_decls),
-    Ended(false),
-    EndLocOfLastDecl(PrepRec.begin()->getSourceRange().getBegin())
+    Ended(false)
 {
   Populate_Needs_Undef();
-  Advance();
+  Build_Events();
+
+  if (Events.empty()) {
+    Ended = true;
+  } else {
+    Current = Events[0];
+  }
 }
 
 SourceLocation TopLevelASTIterator::Return::Get_Location(void)
@@ -99,90 +104,157 @@ void TopLevelASTIterator::Populate_Needs_Undef(void)
   std::sort(NeedsUndef.begin(), NeedsUndef.end(), CompareMacroUndefLoc(BeforeClass));
 }
 
-bool TopLevelASTIterator::Advance(void)
+TopLevelASTIterator::LocKey TopLevelASTIterator::Get_Key(const SourceLocation &loc)
 {
-  SourceManager &sm = AST->getSourceManager();
-  const SourceLocation &end = sm.getLocForEndOfFile(sm.getMainFileID());
-
-#define NEXT_DECL_IF_EXISTS(DeclIt, end) ((DeclIt) != AST->top_level_end()) \
-                                         ? (*(DeclIt))->getLocation() \
-                                         : (end)
-#define NEXT_PREP_IF_EXISTS(MacroIt, end) ((MacroIt) != PrepRec.end()) \
-                                         ? (*(MacroIt))->getSourceRange().getBegin() \
-                                         : (end)
-#define NEXT_UNDEF_IF_EXISTS(UndefIt, end) (UndefIt < NeedsUndef.size()) \
-                                           ? (NeedsUndef)[UndefIt]->getLocation() \
-                                           : (end);
-
-  SourceLocation end_of_last_decl = EndLocOfLastDecl;
-
-  do {
-    const SourceLocation &next_decl_loc = NEXT_DECL_IF_EXISTS(DeclIt, end);
-    const SourceLocation &next_prep_loc = NEXT_PREP_IF_EXISTS(MacroIt, end);
-    const SourceLocation &next_undef_loc = NEXT_UNDEF_IF_EXISTS(UndefIt, end);
-
-    // Find out what comes first.
-    std::vector<SourceLocation> vec = {
-      next_decl_loc,
-      next_prep_loc,
-      next_undef_loc,
-    };
-
-    class CompareLocWithAssertion
-    {
-      public:
-      CompareLocWithAssertion(BeforeThanCompare<SourceLocation> &beforeclass)
-        : BeforeClassRef(beforeclass)
-      { }
-
-      bool operator()(const SourceLocation &a, const SourceLocation &b)
-      {
-        assert(a.isValid());
-        assert(b.isValid());
-        return BeforeClassRef(a, b);
-      }
+  LocKey key;
+  key.Loc = loc;
 
-      BeforeThanCompare<SourceLocation> &BeforeClassRef;
-    };
+  if (loc.isFileID()) {
+    std::pair<FileID, unsigned> decomposed = SM.getDecomposedLoc(loc);
+    key.File = decomposed.first;
+    key.Offset = decomposed.second;
+  }
 
-    std::sort(vec.begin(), vec.end(), CompareLocWithAssertion(BeforeClass));
+  return key;
+}
 
-    /* Check which comes next.  */
-    const SourceLocation &next = vec[0];
-    if (next == end) {
-      /* We reached the end.  */
-      Ended = true;
-      return false;
+void TopLevelASTIterator::Build_Events(void)
+{
+  /* The decls, preprocessed entities and undefs are each already in the
+     order they should be output, so do a single merge of them.  In case of
+     ties decls comes first, then preprocessed entities, then undefs.  */
+  const LocKey end = Get_Key(SM.getLocForEndOfFile(SM.getMainFileID()));
+
+  std::vector<Decl *> decls(AST->top_level_begin(), AST->top_level_end());
+  std::vector<PreprocessedEntity *> preps(PrepRec.begin(), PrepRec.end());
+
+  size_t decl_it = 0, prep_it = 0, undef_it = 0;
+
+  /* Entities which are inside the last decl are skipped when
+     SkipMacrosInDecls is set.  */
+  LocKey end_of_last_decl = Get_Key(preps[0]->getSourceRange().getBegin());
+  LocKey threshold = end_of_last_decl;
+
+  LocKey decl_key, prep_key, undef_key;
+  if (decl_it < decls.size())
+    decl_key = Get_Key(decls[decl_it]->getLocation());
+  if (prep_it < preps.size())
+    prep_key = Get_Key(preps[prep_it]->getSourceRange().getBegin());
+  if (undef_it < NeedsUndef.size())
+    undef_key = Get_Key(NeedsUndef[undef_it]->getLocation());
+
+  while (true) {
+    bool has_decl = decl_it < decls.size();
+    bool has_prep = prep_it < preps.size();
+    bool has_undef = undef_it < NeedsUndef.size();
+
+    /* Find out what comes first.  */
+    const LocKey *next = nullptr;
+    if (has_decl)
+      next = &decl_key;
+    if (has_prep && (next == nullptr || Is_Before(prep_key, *next)))
+      next = &prep_key;
+    if (has_undef && (next == nullptr || Is_Before(undef_key, *next)))
+      next = &undef_key;
+
+    /* We reached the end.  An exhausted list behaves as if its next entity
+       is at the end of the main file.  */
+    if (next == nullptr || next->Loc == end.Loc) {
+      break;
+    }
+    if ((!has_decl || !has_prep || !has_undef) && !Is_Before(*next, end)) {
+      break;
     }
 
-    if (next == next_decl_loc) {
-      EndLocOfLastDecl = (*DeclIt)->getEndLoc();
-      Current = Return(*DeclIt);
-      ++DeclIt;
+    Return current;
+    LocKey key = *next;
+    if (next == &decl_key) {
+      current = Return(decls[decl_it]);
+      end_of_last_decl = Get_Key(decls[decl_it]->getEndLoc());
+      if (++decl_it < decls.size())
+        decl_key = Get_Key(decls[decl_it]->getLocation());
+    } else if (next == &prep_key) {
+      current = Return(preps[prep_it]);
+      if (++prep_it < preps.size())
+        prep_key = Get_Key(preps[prep_it]->getSourceRange().getBegin());
+    } else {
+      current = Return(NeedsUndef[undef_it]);
+      if (++undef_it < NeedsUndef.size())
+        undef_key = Get_Key(NeedsUndef[undef_it]->getLocation());
+    }
 
-    } else if (next == next_prep_loc) {
-      Current = Return(*MacroIt);
-      ++MacroIt;
+    if (SkipMacrosInDecls && Is_Before(key, threshold)) {
+      continue;
     }
-    else if (next == next_undef_loc) {
-      Current = Return(NeedsUndef[UndefIt]);
-      ++UndefIt;
+
+    Events.push_back(current);
+    Keys.push_back(key);
+    if (MaxKeys.empty() || Is_Before(MaxKeys.back(), key)) {
+      MaxKeys.push_back(key);
+    } else {
+      MaxKeys.push_back(MaxKeys.back());
     }
-  } while (SkipMacrosInDecls && Is_Before(Current.Get_Location(), end_of_last_decl));
 
+    threshold = end_of_last_decl;
+  }
+}
+
+bool TopLevelASTIterator::Advance(void)
+{
+  if (Index + 1 >= Events.size()) {
+    Index = Events.size();
+    Ended = true;
+    return false;
+  }
+
+  Current = Events[++Index];
   return true;
 }
 
+unsigned TopLevelASTIterator::Find_First_Not_Before(unsigned start,
+                                                   const LocKey &loc)
+{
+  auto it = std::partition_point(MaxKeys.begin() + start, MaxKeys.end(),
+                                 [&](const LocKey &key) {
+                                   return Is_Before(key, loc);
+                                 });
+  unsigned i = it - MaxKeys.begin();
+
+  /* If the maximum at start is already not before loc it may be because of
+     an entity earlier than start, so we can't trust it.  */
+  if (i == start) {
+    while (i < Keys.size() && Is_Before(Keys[i], loc)) {
+      i++;
+    }
+  }
+
+  return i;
+}
+
 bool TopLevelASTIterator::Skip_Until(const SourceLocation &loc)
 {
-  bool valid = Current.Type != ReturnType::TYPE_INVALID;
-  SourceLocation current = Current.Get_Location();
-  while (valid && Is_Before(current, loc)) {
-    valid = Advance();
-    current = Current.Get_Location();
+  if (Current.Type == ReturnType::TYPE_INVALID) {
+    return false;
+  }
+
+  LocKey key = Get_Key(loc);
+  unsigned current = std::min<size_t>(Index, Events.size() - 1);
+  if (!Is_Before(Keys[current], key)) {
+    return true;
+  }
+
+  unsigned i = Find_First_Not_Before(current + 1, key);
+  if (i >= Events.size()) {
+    /* Consumed everything.  */
+    Index = Events.size();
+    Current = Events.back();
+    Ended = true;
+    return false;
   }
 
-  return valid;
+  Index = i;
+  Current = Events[i];
+  return true;
 }
 
 #include "PrettyPrint.hh"
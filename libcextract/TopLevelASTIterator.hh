@@ -79,6 +79,8 @@ class TopLevelASTIterator
   }
 
   bool Advance(void);
+
+  /** Advance until the current entity is not before loc.  */
   bool Skip_Until(const SourceLocation &loc);
 
   inline bool Is_Current_A_Decl()
@@ -120,22 +122,45 @@ class TopLevelASTIterator
   }
 
   private:
+  /** A SourceLocation decomposed into FileID and offset, so that locations in
+      the same file can be compared without asking the SourceManager.  */
+  struct LocKey
+  {
+    SourceLocation Loc;
+    /* Invalid if Loc is a macro location.  */
+    FileID File;
+    unsigned Offset = 0;
+  };
+
+  LocKey Get_Key(const SourceLocation &loc);
+
   void Populate_Needs_Undef(void);
 
+  /** Merge the decls, preprocessed entities and undefs into Events.  */
+  void Build_Events(void);
+
+  /** Find the first event from start which is not before loc.  */
+  unsigned Find_First_Not_Before(unsigned start, const LocKey &loc);
+
   ASTUnit *AST;
   SourceManager &SM;
   PreprocessingRecord &PrepRec;
 
-  /* AST iterator.  */
-  ASTUnit::top_level_iterator DeclIt;
-
-  /* Macro Iterators.  */
-  PreprocessingRecord::iterator MacroIt;
-  unsigned UndefIt;
-
   /* Vector of macros that needs to be undeclared.  */
   std::vector<MacroDirective*> NeedsUndef;
 
+  /* Entities in the order they should be output, and the key of their
+     location.  */
+  std::vector<Return> Events;
+  std::vector<LocKey> Keys;
+
+  /* MaxKeys[i] is the last location among Keys[0..i].  Used to binary search
+     Events, as the location of the entities are not always sorted.  */
+  std::vector<LocKey> MaxKeys;
+
+  /* Index of Current in Events.  */
+  unsigned Index;
+
   /* Comparator for SourceLocations.  */
   BeforeThanCompare<SourceLocation> BeforeClass;
   inline bool Is_Before(const SourceLocation &a, const SourceLocation &b)
@@ -145,6 +170,14 @@ class TopLevelASTIterator
     return BeforeClass(a, b);
   }
 
+  inline bool Is_Before(const LocKey &a, const LocKey &b)
+  {
+    if (a.File.isValid() && a.File == b.File) {
+      return a.Offset < b.Offset;
+    }
+    return Is_Before(a.Loc, b.Loc);
+  }
+
   inline bool Is_After(const SourceLocation &a, const SourceLocation &b)
   {
     assert(a.isValid());
@@ -156,7 +189,6 @@ class TopLevelASTIterator
 
   bool SkipMacrosInDecls;
   bool Ended;
-  SourceLocation EndLocOfLastDecl;
 
   public:
   void Debug_Print(void);
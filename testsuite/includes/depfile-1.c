@@ -0,0 +1,18 @@
+/* { dg-options "-DCE_EXTRACT_FUNCTIONS=f -DCE_NO_EXTERNALIZATION -DCE_KEEP_INCLUDES" }*/
+
+/* Writing the dependency file must not change the output.  header-4.h
+   contributes nothing to it, so it must not be listed.  */
+#include "header-2.h"
+#include "header-4.h"
+
+int f(void)
+{
+  return MACRO;
+}
+
+/* { dg-final { scan-tree-dump "#include \"header-2.h\"" } } */
+/* { dg-final { scan-tree-dump "return MACRO;" } } */
+/* { dg-final { scan-depfile "^\S+\.CE\.c:" } } */
+/* { dg-final { scan-depfile "depfile-1\.c" } } */
+/* { dg-final { scan-depfile "header-2\.h" } } */
+/* { dg-final { scan-depfile-not "header-4\.h" } } */
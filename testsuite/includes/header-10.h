@@ -0,0 +1 @@
+int NAME(void);
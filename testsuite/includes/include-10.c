@@ -0,0 +1,19 @@
+/* { dg-options "-DCE_EXTRACT_FUNCTIONS=f -DCE_NO_EXTERNALIZATION -DCE_KEEP_INCLUDES" }*/
+
+/* The same header is included twice, and each inclusion declares something
+   different.  */
+#define NAME first
+#include "header-10.h"
+#undef NAME
+
+#define NAME second
+#include "header-10.h"
+#undef NAME
+
+int f(void)
+{
+  return second();
+}
+
+/* { dg-final { scan-tree-dump "#include \"header-10.h\"" } } */
+/* { dg-final { scan-tree-dump "return second\(\);" } } */
@@ -0,0 +1,12 @@
+/* { dg-options "-DCE_EXTRACT_FUNCTIONS=g -DCE_NO_EXTERNALIZATION -DCE_EXPANSION_POLICY_FILE=$test_dir/expansion-policy-1.txt" }*/
+
+#include "other/other-header-1.h"
+
+int g(void)
+{
+  return f();
+}
+
+/* { dg-final { scan-tree-dump "return 3;" } } */
+/* { dg-final { scan-tree-dump "return f\(\);" } } */
+/* { dg-final { scan-tree-dump-not "#include \"other/other-header-1.h\"" } } */
@@ -0,0 +1,20 @@
+/* { dg-options "-DCE_EXTRACT_FUNCTIONS=f -DCE_NO_EXTERNALIZATION -DCE_KEEP_INCLUDES -DCE_EXPAND_INCLUDES=header-10.h" }*/
+
+/* The same header is included twice.  Only the first inclusion is expanded,
+   so `second` must be mapped to the second inclusion, which is kept.  */
+#define NAME first
+#include "header-10.h"
+#undef NAME
+
+#define NAME second
+#include "header-10.h"
+#undef NAME
+
+int f(void)
+{
+  return second();
+}
+
+/* { dg-final { scan-tree-dump "#include \"header-10.h\"" } } */
+/* { dg-final { scan-tree-dump "return second\(\);" } } */
+/* { dg-final { scan-tree-dump-not "int second\(void\);" } } */
@@ -51,12 +51,18 @@ class UnitTest:
         self.options = self.extract_options()
         self.must_have = self.extract_must_have()
         self.must_not_have = self.extract_must_not_have()
+        self.depfile_must_have = self.extract_depfile_must_have()
+        self.depfile_must_not_have = self.extract_depfile_must_not_have()
+        self.header_must_have = self.extract_header_must_have()
+        self.header_must_not_have = self.extract_header_must_not_have()
         self.error_msgs = self.extract_error_msgs()
         self.warning_msgs = self.extract_warning_msgs()
         self.compile_options = self.extract_must_compile()
         self.skip_silently = self.should_skip_test_silently()
         self.no_debuginfo = self.without_debuginfo()
         self.no_ipa_clones = self.without_ipaclones()
+        self.run_twice = self.should_run_twice()
+        self.compare_options = self.extract_compare_options()
         self.skip_on_archs = self.should_skip_test_on_archs()
 
         self.binaries_path = binaries_path
@@ -142,6 +148,56 @@ class UnitTest:
 
         return matches
 
+    # Extract rules that must be in the dependency file.  If there is any rule
+    # for the dependency file, the test is run with -DCE_DEPFILE.
+    def extract_depfile_must_have(self):
+        p = re.compile('{ *dg-final *{ *scan-depfile *"(.*)" *} *}')
+
+        matches = []
+        for line in self.lines:
+            matched = re.search(p, line)
+            if matched is not None:
+                matches.append(matched.group(1))
+
+        return matches
+
+    # Extract rules that must NOT be in the dependency file.
+    def extract_depfile_must_not_have(self):
+        p = re.compile('{ *dg-final *{ *scan-depfile-not *"(.*)" *} *}')
+
+        matches = []
+        for line in self.lines:
+            matched = re.search(p, line)
+            if matched is not None:
+                matches.append(matched.group(1))
+
+        return matches
+
+    # Extract rules that must be in the prototype header.  If there are rules
+    # for the header, the test is run with -DCE_OUTPUT_FUNCTION_PROTOTYPE_HEADER.
+    def extract_header_must_have(self):
+        p = re.compile('{ *dg-final *{ *scan-header *"(.*)" *} *}')
+
+        matches = []
+        for line in self.lines:
+            matched = re.search(p, line)
+            if matched is not None:
+                matches.append(matched.group(1))
+
+        return matches
+
+    # Extract rules that must NOT be in the prototype header.
+    def extract_header_must_not_have(self):
+        p = re.compile('{ *dg-final *{ *scan-header-not *"(.*)" *} *}')
+
+        matches = []
+        for line in self.lines:
+            matched = re.search(p, line)
+            if matched is not None:
+                matches.append(matched.group(1))
+
+        return matches
+
     # Flag that test must XFAIL
     def extract_should_xfail(self):
         p = re.compile('{ *dg-xfail *}')
@@ -196,6 +252,49 @@ class UnitTest:
 
         return False
 
+    # Extract options passed through dg-compare-output.  The tool is run again
+    # with them added, and its output must be the same byte for byte.
+    def extract_compare_options(self):
+        p = re.compile('{ *dg-compare-output "(.*)" *}')
+        matches = re.search(p, self.file_content)
+        if matches is not None:
+            matches = matches.group(1)
+            return self.expand_tokens_in_list(matches.split())
+
+        return None
+
+    # Flag that the tool must be run a second time, which must not rewrite the
+    # output.  Used to check -DCE_SKIP_UNCHANGED.  If a file is given, it is
+    # deleted before the second run, which then must create it again.
+    def should_run_twice(self):
+        p = re.compile('{ *dg-run-twice *("(.*)")? *}')
+        matched = re.search(p, self.file_content)
+        if matched is not None:
+            if matched.group(2) is not None:
+                return self.expand_tokens_in_string(matched.group(2))
+            return True
+
+        return False
+
+    # Expand the `$output` token, which is only known when the test runs, into
+    # the path of clang-extract output.
+    def expand_output_token(self, l, ce_output_path):
+        new_list = []
+        for s in l:
+            new_list.append(s.replace("$output", ce_output_path))
+
+        return new_list
+
+    # Files other than the output that the options make clang-extract write.
+    def extract_output_products(self, ce_output_path):
+        products = []
+        for opt in self.options:
+            if '=$output' in opt:
+                products.append(opt.split('=', 1)[1].replace("$output",
+                                                             ce_output_path))
+
+        return products
+
 
     def gcc_compile(self):
         # Do not compile if dg-compile wasn't specified.
@@ -332,6 +431,75 @@ class UnitTest:
 
         return True
 
+    # Check if two outputs are the same, byte for byte.
+    def compare_outputs(self, output, other_output):
+        try:
+            with open(output, mode="rb") as file:
+                content = file.read()
+            with open(other_output, mode="rb") as file:
+                other_content = file.read()
+        except FileNotFoundError:
+            self.log.print("Output to compare not found: " + other_output)
+            return False
+
+        if content != other_content:
+            self.log.print("Output with " + ' '.join(self.compare_options) +
+                           " differs:")
+            self.log.print(other_content.decode(errors='replace'))
+            self.log.print("-----")
+            return False
+
+        return True
+
+    # Check if the dependency file matches the rules in the test.
+    def check_depfile(self, depfile):
+        try:
+            with open(depfile, mode="rt", encoding="utf-8") as file:
+                content = file.read()
+        except FileNotFoundError:
+            self.log.print("Dependency file not found: " + depfile)
+            return False
+
+        self.log.print("depfile:")
+        self.log.print(content)
+        self.log.print("-----")
+
+        for x in self.depfile_must_not_have:
+            if re.search(x, content) is not None:
+                self.log.print("Must not have pattern found in depfile: " + x)
+                return False
+
+        for x in self.depfile_must_have:
+            if re.search(x, content) is None:
+                self.log.print("Must have pattern not found in depfile: " + x)
+                return False
+
+        return True
+
+    def check_header(self, header):
+        try:
+            with open(header, mode="rt", encoding="utf-8") as file:
+                content = file.read()
+        except FileNotFoundError:
+            self.log.print("Prototype header not found: " + header)
+            return False
+
+        self.log.print("header:")
+        self.log.print(content)
+        self.log.print("-----")
+
+        for x in self.header_must_not_have:
+            if re.search(x, content) is not None:
+                self.log.print("Must not have pattern found in header: " + x)
+                return False
+
+        for x in self.header_must_have:
+            if re.search(x, content) is None:
+                self.log.print("Must have pattern not found in header: " + x)
+                return False
+
+        return True
+
     def get_ipa_clones_path(self, elf):
         output_folder = os.path.dirname(elf)
         elf_file = os.path.basename(elf)
@@ -361,13 +529,78 @@ class UnitTest:
 
         command = [ clang_extract, '-DCE_OUTPUT_FILE=' + ce_output_path,
                     self.test_path ]
-        command.extend(self.options)
+        command.extend(self.expand_output_token(self.options, ce_output_path))
+
+        temp_files = [ce_output_path, ce_output_path + '.manifest']
+        temp_files.extend(self.extract_output_products(ce_output_path))
+
+        depfile = None
+        if len(self.depfile_must_have) > 0 or len(self.depfile_must_not_have) > 0:
+            depfile = ce_output_path + '.d'
+            command.append('-DCE_DEPFILE=' + depfile)
+            temp_files.append(depfile)
+
+        header = None
+        if len(self.header_must_have) > 0 or len(self.header_must_not_have) > 0:
+            header = ce_output_path + '.h'
+            command.append('-DCE_OUTPUT_FUNCTION_PROTOTYPE_HEADER=' + header)
+            temp_files.append(header)
 
         tool = subprocess.run(command, timeout=10, stderr=subprocess.STDOUT,
                               stdout=subprocess.PIPE)
 
+        if isinstance(self.run_twice, str) and tool.returncode == 0:
+            # A missing product must not let the second run be skipped.
+            deleted = self.run_twice.replace("$output", ce_output_path)
+            os.remove(deleted)
+            tool = subprocess.run(command, timeout=10, stderr=subprocess.STDOUT,
+                                  stdout=subprocess.PIPE)
+            if os.path.isfile(deleted) == False:
+                self.log.print("Deleted file not created by the second run: " + deleted)
+                self.print_result(1)
+                cleanup_temp_files(temp_files)
+                return 1
+        elif self.run_twice and tool.returncode == 0:
+            # Move the modification time of the output to the past, so a
+            # rewrite by the second run is noticed.
+            os.utime(ce_output_path, (0, 0))
+            tool = subprocess.run(command, timeout=10, stderr=subprocess.STDOUT,
+                                  stdout=subprocess.PIPE)
+            if os.stat(ce_output_path).st_mtime != 0:
+                self.log.print("Output rewritten by the second run")
+                self.print_result(1)
+                cleanup_temp_files(temp_files)
+                return 1
+
+        if self.compare_options is not None and tool.returncode == 0:
+            other_output_path = ce_output_path + '.other.c'
+            temp_files.append(other_output_path)
+            temp_files.extend(self.extract_output_products(other_output_path))
+            other_command = [ clang_extract,
+                              '-DCE_OUTPUT_FILE=' + other_output_path,
+                              self.test_path ]
+            other_command.extend(self.expand_output_token(self.options,
+                                                          other_output_path))
+            other_command.extend(self.compare_options)
+            subprocess.run(other_command, timeout=10,
+                           stderr=subprocess.STDOUT, stdout=subprocess.PIPE)
+            if self.compare_outputs(ce_output_path, other_output_path) == False:
+                self.print_result(1)
+                cleanup_temp_files(temp_files)
+                return 1
+
+        if depfile is not None and self.check_depfile(depfile) == False:
+            self.print_result(1)
+            cleanup_temp_files(temp_files)
+            return 1
+
+        if header is not None and self.check_header(header) == False:
+            self.print_result(1)
+            cleanup_temp_files(temp_files)
+            return 1
+
         r = self.check(tool, ce_output_path)
-        cleanup_temp_files([ce_output_path])
+        cleanup_temp_files(temp_files)
         return r
 
     def run_inline_test(self, lto_test=False):
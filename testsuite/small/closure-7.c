@@ -0,0 +1,32 @@
+/* { dg-options "-DCE_EXTRACT_FUNCTIONS=f,g,h -DCE_NO_EXTERNALIZATION" }*/
+/* { dg-compare-output "-DCE_JOBS=3" } */
+
+/* The leading #include makes a preamble, so the AST has an external source.
+   Computing the closure with -DCE_JOBS must give the same output.  */
+#include "closure-7.h"
+
+struct point make_point(int_t x, int_t y)
+{
+  struct point p = { x, y };
+  return p;
+}
+
+int_t f(void)
+{
+  return make_point(1, 2).x;
+}
+
+int_t g(struct point *p)
+{
+  return p->y;
+}
+
+int h(void)
+{
+  return f() + g(0);
+}
+
+/* { dg-final { scan-tree-dump "typedef int int_t;" } } */
+/* { dg-final { scan-tree-dump "struct point {" } } */
+/* { dg-final { scan-tree-dump "int h\(void\)" } } */
+/* { dg-final { scan-tree-dump-not "struct unused" } } */
@@ -0,0 +1,10 @@
+typedef int int_t;
+
+struct point {
+  int_t x;
+  int_t y;
+};
+
+struct unused {
+  int z;
+};
@@ -0,0 +1,41 @@
+/* { dg-options "-DCE_EXTRACT_FUNCTIONS=f,g,h -DCE_NO_EXTERNALIZATION" }*/
+/* { dg-compare-output "-DCE_JOBS=3" } */
+
+/* Without #includes there is no preamble, so -DCE_JOBS computes the closure
+   in parallel.  The merged result must be the same as the serial one.  */
+typedef int int_t;
+
+struct point {
+  int_t x;
+  int_t y;
+};
+
+struct unused {
+  int z;
+};
+
+struct point make_point(int_t x, int_t y)
+{
+  struct point p = { x, y };
+  return p;
+}
+
+int_t f(void)
+{
+  return make_point(1, 2).x;
+}
+
+int_t g(struct point *p)
+{
+  return p->y;
+}
+
+int h(void)
+{
+  return f() + g(0);
+}
+
+/* { dg-final { scan-tree-dump "typedef int int_t;" } } */
+/* { dg-final { scan-tree-dump "struct point make_point\(int_t x, int_t y\)" } } */
+/* { dg-final { scan-tree-dump "int h\(void\)" } } */
+/* { dg-final { scan-tree-dump-not "struct unused" } } */
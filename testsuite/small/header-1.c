@@ -0,0 +1,19 @@
+/* { dg-options "-DCE_EXTRACT_FUNCTIONS=f -DCE_EXPORT_SYMBOLS=g -DCE_RENAME_SYMBOLS" }*/
+
+/* Only the renamed f goes into the prototype header, without its body.  */
+static int g()
+{
+  volatile int x = 3;
+  return x;
+}
+
+int f(void)
+{
+  return g();
+}
+
+/* { dg-final { scan-tree-dump "int klpp_f\(void\)\n{\n *return \(\*klpe_g\)\(\)" } } */
+/* { dg-final { scan-header "int klpp_f\(void\)" } } */
+/* { dg-final { scan-header-not "return" } } */
+/* { dg-final { scan-header-not "klpe_g" } } */
+/* { dg-final { scan-header-not "int f\(void\)" } } */
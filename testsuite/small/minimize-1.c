@@ -0,0 +1,28 @@
+/* { dg-options "-DCE_EXTRACT_FUNCTIONS=f -DCE_NO_EXTERNALIZATION -DCE_MINIMIZE_OUTPUT" }*/
+
+typedef unsigned long ulong_t;
+
+struct inner {
+  ulong_t a;
+};
+
+struct opaque {
+  struct inner in;
+  int b;
+};
+
+struct visible {
+  struct opaque *o;
+  int c;
+};
+
+int f(struct visible *v)
+{
+  return v->c;
+}
+
+/* { dg-final { scan-tree-dump "struct visible {" } } */
+/* { dg-final { scan-tree-dump "struct opaque;" } } */
+/* { dg-final { scan-tree-dump-not "struct opaque {" } } */
+/* { dg-final { scan-tree-dump-not "struct inner" } } */
+/* { dg-final { scan-tree-dump-not "ulong_t" } } */
@@ -0,0 +1,16 @@
+/* { dg-options "-DCE_EXTRACT_FUNCTIONS=f -DCE_EXPORT_SYMBOLS=var -DCE_RENAME_SYMBOLS" }*/
+
+int var;
+
+int f(void)
+{
+  int x;
+  /* Only the references to var in the code are renamed.  */
+  x=var;
+  var=x+1;
+  return x;
+}
+
+/* { dg-final { scan-tree-dump "x=\(\*klpe_var\);" } } */
+/* { dg-final { scan-tree-dump "\(\*klpe_var\)=x\+1;" } } */
+/* { dg-final { scan-tree-dump "/\* Only the references to var in the code are renamed\.  \*/" } } */
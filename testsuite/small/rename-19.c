@@ -0,0 +1,18 @@
+/* { dg-options "-DCE_EXTRACT_FUNCTIONS=f,g -DCE_RENAME_SYMBOLS" }*/
+
+/* Names inside comments in the range of a decl are left alone, even before
+   the identifier or keyword that is changed.  */
+static /* f */ int f(void)
+{
+  return 0;
+}
+
+int /* static */ static g(void)
+{
+  return f();
+}
+
+/* { dg-final { scan-tree-dump "/\* f \*/ int klpp_f\(void\)" } } */
+/* { dg-final { scan-tree-dump-not "static /\* f \*/" } } */
+/* { dg-final { scan-tree-dump "int /\* static \*/ +klpp_g\(void\)" } } */
+/* { dg-final { scan-tree-dump "return klpp_f\(\);" } } */
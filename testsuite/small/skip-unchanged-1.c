@@ -0,0 +1,15 @@
+/* { dg-options "-DCE_EXTRACT_FUNCTIONS=f -DCE_NO_EXTERNALIZATION -DCE_SKIP_UNCHANGED" }*/
+
+/* There is no manifest for a fresh output, so this must run normally.  */
+int g(void)
+{
+  return 1;
+}
+
+int f(void)
+{
+  return g();
+}
+
+/* { dg-final { scan-tree-dump "int g\(void\)" } } */
+/* { dg-final { scan-tree-dump "return g\(\);" } } */
@@ -0,0 +1,16 @@
+/* { dg-options "-DCE_EXTRACT_FUNCTIONS=f -DCE_NO_EXTERNALIZATION -DCE_SKIP_UNCHANGED" }*/
+/* { dg-run-twice } */
+
+/* Nothing changed since the first run, so the second must be skipped.  */
+int g(void)
+{
+  return 1;
+}
+
+int f(void)
+{
+  return g();
+}
+
+/* { dg-final { scan-tree-dump "int g\(void\)" } } */
+/* { dg-final { scan-tree-dump "return g\(\);" } } */
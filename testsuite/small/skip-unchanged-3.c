@@ -0,0 +1,17 @@
+/* { dg-options "-DCE_EXTRACT_FUNCTIONS=f -DCE_NO_EXTERNALIZATION -DCE_SKIP_UNCHANGED -DCE_OUTPUT_FUNCTION_PROTOTYPE_HEADER=$output.h" }*/
+/* { dg-run-twice "$output.h" } */
+
+/* The prototype header is gone after the first run, so the second must not be
+   skipped.  */
+int g(void)
+{
+  return 1;
+}
+
+int f(void)
+{
+  return g();
+}
+
+/* { dg-final { scan-tree-dump "int g\(void\)" } } */
+/* { dg-final { scan-tree-dump "return g\(\);" } } */